@@ -0,0 +1,305 @@
+// align.hpp : Needleman-Wunsch global alignment kernels.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Scores shared by every kernel; Blast_Base::query has always used these.
+static const int MATCH_BONUS = 2;
+static const int MISMATCH_PENALTY = -1;
+static const int GAP_PENALTY = -1;
+
+// Where the best path into a cell came from. Ties prefer left, then up,
+// then the diagonal, as in the original scalar loop.
+enum : std::uint8_t { TB_STOP = 0, TB_LEFT = 1, TB_UP = 2, TB_DIAG = 3 };
+
+// Two bits per cell, stored by anti-diagonal: cell (i, j) is entry i of
+// diagonal i + j, and every diagonal takes (m + 4) / 4 bytes. A 50x50
+// alignment needs about 1.3 KB.
+struct Traceback {
+  std::size_t m = 0, n = 0;
+  std::size_t stride = 0;
+  std::vector<std::uint8_t> bits;
+
+  void resize(std::size_t rows, std::size_t cols) {
+    m = rows;
+    n = cols;
+    stride = (m + 4) / 4;
+    bits.assign((m + n + 1) * stride, 0);
+  }
+
+  std::uint8_t at(std::size_t i, std::size_t j) const {
+    return (bits[(i + j) * stride + (i >> 2)] >> ((i & 3) * 2)) & 3;
+  }
+
+  void set(std::size_t i, std::size_t j, std::uint8_t dir) {
+    bits[(i + j) * stride + (i >> 2)] |= dir << ((i & 3) * 2);
+  }
+
+  // Packs dirs[lo..hi], one byte per row, into diagonal d.
+  void set_diagonal(std::size_t d, const std::uint8_t* dirs, std::size_t lo, std::size_t hi) {
+    std::uint8_t* row = &bits[d * stride];
+    for (std::size_t i = lo; i <= hi; i++) {
+      row[i >> 2] |= dirs[i] << ((i & 3) * 2);
+    }
+  }
+};
+
+// Straightforward row-by-row fill in int; used for sequences too long for
+// 16-bit lanes and as the reference the vector kernels must match.
+inline int nw_align_scalar(const char* a, std::size_t m, const char* b, std::size_t n,
+                           Traceback* tb, std::vector<std::vector<int>>* scores) {
+  std::vector<int> prev(n + 1), cur(n + 1);
+  if (tb) tb->resize(m, n);
+  if (scores) scores->assign(m + 1, std::vector<int>(n + 1, 0));
+  for (std::size_t i = 0; i <= m; i++) {
+    for (std::size_t j = 0; j <= n; j++) {
+      int score;
+      std::uint8_t dir;
+      if (i == 0 && j == 0) {
+        score = 0;
+        dir = TB_STOP;
+      } else if (i == 0) {
+        score = cur[j - 1] + GAP_PENALTY;
+        dir = TB_LEFT;
+      } else if (j == 0) {
+        score = prev[j] + GAP_PENALTY;
+        dir = TB_UP;
+      } else {
+        int left = cur[j - 1] + GAP_PENALTY;
+        int up = prev[j] + GAP_PENALTY;
+        int diag = prev[j - 1] + (a[i - 1] == b[j - 1] ? MATCH_BONUS : MISMATCH_PENALTY);
+        score = std::max({left, up, diag});
+        dir = score == left ? TB_LEFT : score == up ? TB_UP : TB_DIAG;
+      }
+      cur[j] = score;
+      if (tb) tb->set(i, j, dir);
+      if (scores) (*scores)[i][j] = score;
+    }
+    std::swap(prev, cur);
+  }
+  return prev[n];
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NW_HAVE_X86_DISPATCH 1
+#endif
+
+// int16 score lanes and matching uint8 direction lanes for an L-lane
+// kernel. Spelled out per width: GCC drops vector_size on a dependent type.
+template <int L> struct nw_lanes;
+template <> struct nw_lanes<8> {
+  typedef std::int16_t vec __attribute__((vector_size(16)));
+  typedef std::uint8_t bytes __attribute__((vector_size(8)));
+};
+template <> struct nw_lanes<16> {
+  typedef std::int16_t vec __attribute__((vector_size(32)));
+  typedef std::uint8_t bytes __attribute__((vector_size(16)));
+};
+
+// Anti-diagonal kernel on L int16 lanes using GCC vector extensions. Cell
+// (i, j) depends only on diagonals i + j - 1 and i + j - 2, so each lane
+// takes one row of the current diagonal. The read is reversed so both
+// sequences are read forwards along a diagonal. It is always inlined into
+// the per-ISA wrappers below, which decide the instruction set.
+template <int L>
+__attribute__((always_inline)) inline int nw_align_lanes(const char* a, std::size_t m,
+                                                         const char* b, std::size_t n,
+                                                         Traceback* tb,
+                                                         std::vector<std::vector<int>>* scores) {
+  typedef typename nw_lanes<L>::vec vec;
+  typedef typename nw_lanes<L>::bytes bytes;
+
+  // Row i of a diagonal is stored at index i + 1; index 0 is padding so
+  // the up/diagonal loads at i - 1 never underflow. L slack at the end
+  // absorbs lanes past the last row.
+  std::size_t width = m + 2 + L;
+  std::vector<std::int16_t> buf(3 * width, 0);
+  std::int16_t* d2 = &buf[0];
+  std::int16_t* d1 = &buf[width];
+  std::int16_t* d0 = &buf[2 * width];
+
+  // Base codes; unmatched padding differs between the two sequences.
+  std::vector<std::int16_t> sa(m + L, -1), sb(n + L, -2);
+  for (std::size_t i = 0; i < m; i++) sa[i] = static_cast<unsigned char>(a[i]);
+  for (std::size_t t = 0; t < n; t++) sb[t] = static_cast<unsigned char>(b[n - 1 - t]);
+
+  // Directions of the current diagonal, one byte per row, before packing.
+  std::vector<std::uint8_t> dir_row(tb ? m + 1 + L : 0);
+  if (tb) tb->resize(m, n);
+  if (scores) scores->assign(m + 1, std::vector<int>(n + 1, 0));
+
+  const vec gap = vec{} + GAP_PENALTY;
+  const vec match = vec{} + MATCH_BONUS;
+  const vec mismatch = vec{} + MISMATCH_PENALTY;
+  const vec left_dir = vec{} + std::int16_t(TB_LEFT);
+  const vec up_dir = vec{} + std::int16_t(TB_UP);
+  const vec diag_dir = vec{} + std::int16_t(TB_DIAG);
+
+  for (std::size_t d = 0; d <= m + n; d++) {
+    std::size_t lo = d > n ? d - n : 0;
+    std::size_t hi = std::min(d, m);
+    std::uint8_t* dirs = tb ? dir_row.data() : NULL;
+
+    // Interior cells: 1 <= i <= m, 1 <= j = d - i <= n.
+    std::size_t first = std::max<std::size_t>(lo, 1);
+    std::size_t last = d >= 1 ? std::min(hi, d - 1) : 0;
+    for (std::size_t i = first; i <= last && d >= 2; i += L) {
+      vec left, up, diag, ca, cb;
+      std::memcpy(&left, d1 + i + 1, sizeof(vec));
+      std::memcpy(&up, d1 + i, sizeof(vec));
+      std::memcpy(&diag, d2 + i, sizeof(vec));
+      std::memcpy(&ca, &sa[i - 1], sizeof(vec));
+      std::memcpy(&cb, &sb[n - d + i], sizeof(vec));
+      left += gap;
+      up += gap;
+      diag += (ca == cb) ? match : mismatch;
+      vec h = left > up ? left : up;
+      h = h > diag ? h : diag;
+      std::memcpy(d0 + i + 1, &h, sizeof(vec));
+      if (dirs) {
+        vec dir = (h == left) ? left_dir : ((h == up) ? up_dir : diag_dir);
+        bytes packed = __builtin_convertvector(dir, bytes);
+        std::memcpy(dirs + i, &packed, sizeof(bytes));
+      }
+    }
+
+    // Edges go last so they overwrite whatever the tail lanes left there.
+    if (lo == 0) {
+      d0[1] = static_cast<std::int16_t>(static_cast<int>(d) * GAP_PENALTY);  // (0, d)
+      if (dirs) dirs[0] = d ? TB_LEFT : TB_STOP;
+    }
+    if (hi == d && d > 0) {
+      d0[d + 1] = static_cast<std::int16_t>(static_cast<int>(d) * GAP_PENALTY);  // (d, 0)
+      if (dirs) dirs[d] = TB_UP;
+    }
+    if (tb) tb->set_diagonal(d, dirs, lo, hi);
+    if (scores) {
+      for (std::size_t i = lo; i <= hi; i++) (*scores)[i][d - i] = d0[i + 1];
+    }
+    std::int16_t* t = d2;
+    d2 = d1;
+    d1 = d0;
+    d0 = t;
+  }
+  return d1[m + 1];
+}
+
+#ifdef NW_HAVE_X86_DISPATCH
+__attribute__((target("avx2"))) inline int nw_align_avx2(const char* a, std::size_t m,
+                                                         const char* b, std::size_t n,
+                                                         Traceback* tb,
+                                                         std::vector<std::vector<int>>* scores) {
+  return nw_align_lanes<16>(a, m, b, n, tb, scores);
+}
+
+__attribute__((target("sse4.1"))) inline int nw_align_sse41(const char* a, std::size_t m,
+                                                            const char* b, std::size_t n,
+                                                            Traceback* tb,
+                                                            std::vector<std::vector<int>>* scores) {
+  return nw_align_lanes<8>(a, m, b, n, tb, scores);
+}
+#endif
+
+inline int nw_align_generic(const char* a, std::size_t m, const char* b, std::size_t n,
+                            Traceback* tb, std::vector<std::vector<int>>* scores) {
+  return nw_align_lanes<8>(a, m, b, n, tb, scores);
+}
+
+// Global alignment score of a against b. Fills the traceback and the full
+// score matrix when asked. Picks the widest kernel the CPU supports; every
+// kernel gives the same score and directions as nw_align_scalar.
+inline int nw_align(std::string const& a, std::string const& b, Traceback* tb = NULL,
+                    std::vector<std::vector<int>>* scores = NULL) {
+  std::size_t m = a.size(), n = b.size();
+  // |score| <= 2 * (m + n) must fit an int16 lane.
+  if (m + n > 16000) {
+    return nw_align_scalar(a.data(), m, b.data(), n, tb, scores);
+  }
+#ifdef NW_HAVE_X86_DISPATCH
+  static const int level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse4.1") ? 1 : 0;
+  if (level == 2) return nw_align_avx2(a.data(), m, b.data(), n, tb, scores);
+  if (level == 1) return nw_align_sse41(a.data(), m, b.data(), n, tb, scores);
+#endif
+  return nw_align_generic(a.data(), m, b.data(), n, tb, scores);
+}
+
+// Walks the traceback from (m, n) back to (0, 0), appending to the gapped
+// strings and reversing them once at the end. cigar, when given, gets the
+// path run-length encoded with a as the reference: M for a diagonal step,
+// D for a base of a against a gap, I for a base of b against a gap.
+// TB is Traceback or anything else with m, n and at(i, j).
+template <class TB>
+inline void trace_alignment(TB const& tb, std::string const& a, std::string const& b,
+                            std::string& aligned_a, std::string& aligned_b,
+                            std::string* cigar = NULL) {
+  std::size_t i = tb.m, j = tb.n;
+  aligned_a.clear();
+  aligned_b.clear();
+  aligned_a.reserve(i + j);
+  aligned_b.reserve(i + j);
+  std::vector<std::pair<char, unsigned>> runs;
+  for (std::uint8_t dir; (dir = tb.at(i, j)) != TB_STOP; ) {
+    char op;
+    if (dir == TB_DIAG) {
+      aligned_a += a[--i];
+      aligned_b += b[--j];
+      op = 'M';
+    } else if (dir == TB_UP) {
+      aligned_a += a[--i];
+      aligned_b += '-';
+      op = 'D';
+    } else {
+      aligned_a += '-';
+      aligned_b += b[--j];
+      op = 'I';
+    }
+    if (cigar) {
+      if (!runs.empty() && runs.back().first == op) runs.back().second++;
+      else runs.emplace_back(op, 1);
+    }
+  }
+  std::reverse(aligned_a.begin(), aligned_a.end());
+  std::reverse(aligned_b.begin(), aligned_b.end());
+  if (cigar) {
+    cigar->clear();
+    for (auto r = runs.rbegin(); r != runs.rend(); ++r) {
+      *cigar += std::to_string(r->second);
+      *cigar += r->first;
+    }
+  }
+}
+
+// The gapped strings trace_alignment wrote along with cigar, rebuilt from
+// cigar and the two sequences.
+inline void expand_cigar(std::string const& cigar, std::string const& a, std::string const& b,
+                         std::string& aligned_a, std::string& aligned_b) {
+  aligned_a.clear();
+  aligned_b.clear();
+  std::size_t i = 0, j = 0, run = 0;
+  for (char c : cigar) {
+    if (c >= '0' && c <= '9') {
+      run = run * 10 + (c - '0');
+      continue;
+    }
+    if (c == 'I') {
+      aligned_a.append(run, '-');
+    } else {
+      aligned_a.append(a, i, run);
+      i += run;
+    }
+    if (c == 'D') {
+      aligned_b.append(run, '-');
+    } else {
+      aligned_b.append(b, j, run);
+      j += run;
+    }
+    run = 0;
+  }
+}
@@ -0,0 +1,138 @@
+// align_banded.hpp : global alignment restricted to a band around a seed
+// diagonal.
+//
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "align.hpp"
+
+// Directions for the cells of a band, two bits each. Row i keeps columns
+// j = i + diag - w .. i + diag + w, so every row takes the same 2w + 1
+// cells and the whole traceback is (m + 1) * stride bytes, O(m * w).
+struct BandedTraceback {
+  std::size_t m = 0, n = 0;
+  std::ptrdiff_t diag = 0;
+  std::size_t w = 0;
+  std::size_t stride = 0;
+  std::vector<std::uint8_t> bits;
+
+  void resize(std::size_t rows, std::size_t cols, std::ptrdiff_t d, std::size_t width) {
+    m = rows;
+    n = cols;
+    diag = d;
+    w = width;
+    stride = (2 * w + 1 + 3) / 4;
+    bits.assign((m + 1) * stride, 0);
+  }
+
+  // Band column of (i, j); at least 2w + 1 when (i, j) lies outside.
+  std::size_t column(std::size_t i, std::size_t j) const {
+    std::ptrdiff_t c = std::ptrdiff_t(j) - (std::ptrdiff_t(i) + diag - std::ptrdiff_t(w));
+    return c < 0 ? 2 * w + 1 : std::size_t(c);
+  }
+
+  std::uint8_t at(std::size_t i, std::size_t j) const {
+    std::size_t c = column(i, j);
+    if (c > 2 * w) return TB_STOP;
+    return (bits[i * stride + (c >> 2)] >> ((c & 3) * 2)) & 3;
+  }
+
+  void set(std::size_t i, std::size_t c, std::uint8_t dir) {
+    bits[i * stride + (c >> 2)] |= dir << ((c & 3) * 2);
+  }
+};
+
+// Global alignment of a against b using only cells with
+// |j - i - diag| <= w; everything outside the band scores as unreachable.
+// Scores and tie order follow nw_align_scalar, so a best path that fits
+// in the band comes out the same. w is widened first if (0, 0) or (m, n)
+// would fall outside. edge, when given, is set if the chosen path runs
+// along a side of the band where it was cut off, i.e. a wider band might
+// have found something better.
+inline int nw_align_banded(std::string const& a, std::string const& b, std::ptrdiff_t diag,
+                           std::size_t w, BandedTraceback* tb, bool* edge = NULL) {
+  std::size_t m = a.size(), n = b.size();
+  std::ptrdiff_t corner = std::ptrdiff_t(n) - std::ptrdiff_t(m) - diag;
+  w = std::max<std::size_t>({ w, std::size_t(diag < 0 ? -diag : diag),
+                              std::size_t(corner < 0 ? -corner : corner) });
+  std::size_t width = 2 * w + 1;
+  static const int NEG = INT_MIN / 4;
+
+  // Two band rows with a sentinel past each end: prev[c + 1] is the up
+  // neighbour of column c, cur[c - 1] its left neighbour.
+  std::vector<int> prev_row(width + 2, NEG), cur_row(width + 2, NEG);
+  int* prev = &prev_row[1];
+  int* cur = &cur_row[1];
+  BandedTraceback local;
+  if (!tb) tb = &local;
+  tb->resize(m, n, diag, w);
+
+  for (std::size_t i = 0; i <= m; i++) {
+    std::ptrdiff_t j0 = std::ptrdiff_t(i) + diag - std::ptrdiff_t(w);
+    for (std::size_t c = 0; c < width; c++) {
+      std::ptrdiff_t j = j0 + std::ptrdiff_t(c);
+      if (j < 0 || j > std::ptrdiff_t(n)) {
+        cur[c] = NEG;
+        continue;
+      }
+      int score;
+      std::uint8_t dir;
+      if (i == 0 && j == 0) {
+        score = 0;
+        dir = TB_STOP;
+      } else if (i == 0) {
+        score = static_cast<int>(j) * GAP_PENALTY;
+        dir = TB_LEFT;
+      } else if (j == 0) {
+        score = static_cast<int>(i) * GAP_PENALTY;
+        dir = TB_UP;
+      } else {
+        int left = cur[c - 1] + GAP_PENALTY;
+        int up = prev[c + 1] + GAP_PENALTY;
+        int diag_score = prev[c] + (a[i - 1] == b[j - 1] ? MATCH_BONUS : MISMATCH_PENALTY);
+        score = std::max({ left, up, diag_score });
+        dir = score == left ? TB_LEFT : score == up ? TB_UP : TB_DIAG;
+      }
+      cur[c] = score;
+      tb->set(i, c, dir);
+    }
+    std::swap(prev, cur);
+  }
+  int score = prev[tb->column(m, n)];
+
+  if (edge) {
+    *edge = false;
+    std::size_t i = m, j = n;
+    for (std::uint8_t dir; (dir = tb->at(i, j)) != TB_STOP; ) {
+      std::size_t c = tb->column(i, j);
+      if ((c == 0 && j > 0) || (c == 2 * w && i > 0)) {
+        *edge = true;
+        break;
+      }
+      if (dir != TB_LEFT) i--;
+      if (dir != TB_UP) j--;
+    }
+  }
+  return score;
+}
+
+// Runs nw_align_banded with width w and doubles it while the best path
+// keeps running into the edge. Ends with the whole matrix in the band at
+// worst, where the result equals nw_align.
+inline int nw_align_adaptive(std::string const& a, std::string const& b, std::ptrdiff_t diag,
+                             std::size_t w, BandedTraceback* tb) {
+  std::size_t limit = a.size() + b.size() + std::size_t(diag < 0 ? -diag : diag);
+  w = std::max<std::size_t>(w, 1);
+  for (;;) {
+    bool edge = false;
+    int score = nw_align_banded(a, b, diag, w, tb, &edge);
+    if (!edge || w >= limit) return score;
+    w *= 2;
+  }
+}
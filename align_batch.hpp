@@ -0,0 +1,196 @@
+// align_batch.hpp : many independent global alignments at once, one
+// (seq1, seq2) pair per SIMD lane.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "align.hpp"
+
+struct SeqPair {
+  const std::string* seq1;
+  const std::string* seq2;
+};
+
+// Score lanes of type T, L per register, and uint8 direction lanes to
+// match. Spelled out per width like nw_lanes.
+template <class T, int L> struct batch_lanes;
+template <> struct batch_lanes<std::int8_t, 16> {
+  typedef std::int8_t vec __attribute__((vector_size(16)));
+  typedef std::uint8_t bytes __attribute__((vector_size(16)));
+};
+template <> struct batch_lanes<std::int8_t, 32> {
+  typedef std::int8_t vec __attribute__((vector_size(32)));
+  typedef std::uint8_t bytes __attribute__((vector_size(32)));
+};
+template <> struct batch_lanes<std::int16_t, 8> {
+  typedef std::int16_t vec __attribute__((vector_size(16)));
+  typedef std::uint8_t bytes __attribute__((vector_size(8)));
+};
+template <> struct batch_lanes<std::int16_t, 16> {
+  typedef std::int16_t vec __attribute__((vector_size(32)));
+  typedef std::uint8_t bytes __attribute__((vector_size(16)));
+};
+
+// Row-by-row fill of up to L pairs, lane k holding pairs[k]. Pairs shorter
+// than the longest in the group are padded; padding only ever feeds cells
+// past (m_k, n_k), so each lane's score is read off at its own corner.
+// Directions are kept per cell with the lanes interleaved and split into
+// per-pair Tracebacks at the end.
+template <class T, int L>
+__attribute__((always_inline)) inline void nw_batch_lanes(const SeqPair* pairs, std::size_t count,
+                                                          int* scores, Traceback* tbs) {
+  typedef typename batch_lanes<T, L>::vec vec;
+  typedef typename batch_lanes<T, L>::bytes bytes;
+
+  std::size_t M = 0, N = 0;
+  for (std::size_t k = 0; k < count; k++) {
+    M = std::max(M, pairs[k].seq1->size());
+    N = std::max(N, pairs[k].seq2->size());
+  }
+
+  // Transposed sequences: row i of A holds base i of every lane's seq1.
+  std::vector<T> A(std::max<std::size_t>(M, 1) * L, T(-1));
+  std::vector<T> B(std::max<std::size_t>(N, 1) * L, T(-2));
+  for (std::size_t k = 0; k < count; k++) {
+    std::string const& a = *pairs[k].seq1;
+    std::string const& b = *pairs[k].seq2;
+    for (std::size_t i = 0; i < a.size(); i++) A[i * L + k] = static_cast<T>(a[i] & 0x7f);
+    for (std::size_t j = 0; j < b.size(); j++) B[j * L + k] = static_cast<T>(b[j] & 0x7f);
+  }
+
+  // Score rows, lane-interleaved like A and B; only the previous row is
+  // kept. Plain T storage with memcpy loads keeps alignment out of it.
+  std::vector<T> prev_row((N + 1) * L), cur_row((N + 1) * L);
+  T* prev = prev_row.data();
+  T* cur = cur_row.data();
+  std::vector<std::uint8_t> dirs(tbs ? (M + 1) * (N + 1) * L : 0);
+
+  const vec gap = vec{} + T(GAP_PENALTY);
+  const vec match = vec{} + T(MATCH_BONUS);
+  const vec mismatch = vec{} + T(MISMATCH_PENALTY);
+  const vec left_dir = vec{} + T(TB_LEFT);
+  const vec up_dir = vec{} + T(TB_UP);
+  const vec diag_dir = vec{} + T(TB_DIAG);
+
+  auto collect = [&](std::size_t i, const T* row) {
+    for (std::size_t k = 0; k < count; k++) {
+      if (pairs[k].seq1->size() == i) scores[k] = row[pairs[k].seq2->size() * L + k];
+    }
+  };
+
+  for (std::size_t j = 0; j <= N; j++) {
+    for (int k = 0; k < L; k++) prev[j * L + k] = T(static_cast<int>(j) * GAP_PENALTY);
+  }
+  collect(0, prev);
+
+  for (std::size_t i = 1; i <= M; i++) {
+    // No helpers taking or returning vec here: unless they are inlined,
+    // passing a 256-bit vector across the ISA boundary breaks the ABI.
+    vec ca, cb, h, up_in, diag_in;
+    std::memcpy(&ca, &A[(i - 1) * L], sizeof(vec));
+    h = vec{} + T(static_cast<int>(i) * GAP_PENALTY);
+    std::memcpy(cur, &h, sizeof(vec));
+    std::memcpy(&diag_in, prev, sizeof(vec));
+    for (std::size_t j = 1; j <= N; j++) {
+      std::memcpy(&cb, &B[(j - 1) * L], sizeof(vec));
+      std::memcpy(&up_in, prev + j * L, sizeof(vec));
+      vec left = h + gap;
+      vec up = up_in + gap;
+      vec diag = diag_in + ((ca == cb) ? match : mismatch);
+      h = left > up ? left : up;
+      h = h > diag ? h : diag;
+      std::memcpy(cur + j * L, &h, sizeof(vec));
+      diag_in = up_in;
+      if (tbs) {
+        vec dir = (h == left) ? left_dir : ((h == up) ? up_dir : diag_dir);
+        bytes packed = __builtin_convertvector(dir, bytes);
+        std::memcpy(&dirs[(i * (N + 1) + j) * L], &packed, sizeof(bytes));
+      }
+    }
+    collect(i, cur);
+    std::swap(prev, cur);
+  }
+
+  if (!tbs) return;
+  for (std::size_t k = 0; k < count; k++) {
+    std::size_t m = pairs[k].seq1->size(), n = pairs[k].seq2->size();
+    Traceback& tb = tbs[k];
+    tb.resize(m, n);
+    for (std::size_t j = 1; j <= n; j++) tb.set(0, j, TB_LEFT);
+    for (std::size_t i = 1; i <= m; i++) {
+      tb.set(i, 0, TB_UP);
+      for (std::size_t j = 1; j <= n; j++) tb.set(i, j, dirs[(i * (N + 1) + j) * L + k]);
+    }
+  }
+}
+
+// int8 lanes are exact while every cell stays within [-128, 127]: cell
+// (i, j) lies in [-(i + j), 2 * min(i, j)].
+inline bool nw_batch_fits_int8(std::size_t M, std::size_t N) {
+  return M + N <= 127 && 2 * std::min(M, N) <= 127;
+}
+
+#ifdef NW_HAVE_X86_DISPATCH
+__attribute__((target("avx2"))) inline void nw_batch_avx2(const SeqPair* pairs, std::size_t count,
+                                                          int* scores, Traceback* tbs, bool narrow) {
+  if (narrow) nw_batch_lanes<std::int8_t, 32>(pairs, count, scores, tbs);
+  else nw_batch_lanes<std::int16_t, 16>(pairs, count, scores, tbs);
+}
+
+__attribute__((target("sse4.1"))) inline void nw_batch_sse41(const SeqPair* pairs, std::size_t count,
+                                                             int* scores, Traceback* tbs, bool narrow) {
+  if (narrow) nw_batch_lanes<std::int8_t, 16>(pairs, count, scores, tbs);
+  else nw_batch_lanes<std::int16_t, 8>(pairs, count, scores, tbs);
+}
+#endif
+
+inline void nw_batch_generic(const SeqPair* pairs, std::size_t count, int* scores,
+                             Traceback* tbs, bool narrow) {
+  if (narrow) nw_batch_lanes<std::int8_t, 16>(pairs, count, scores, tbs);
+  else nw_batch_lanes<std::int16_t, 8>(pairs, count, scores, tbs);
+}
+
+// Scores every pair, and fills tbs[k] for pair k when tbs is given. Pairs
+// go through in groups of one register's worth of lanes: 32 (AVX2) or 16
+// int8 lanes when the group is short enough, 16 or 8 int16 lanes
+// otherwise. Results match nw_align pair by pair.
+inline void nw_align_batch(std::vector<SeqPair> const& pairs, std::vector<int>& scores,
+                           std::vector<Traceback>* tbs = NULL) {
+  scores.assign(pairs.size(), 0);
+  if (tbs) tbs->assign(pairs.size(), Traceback());
+#ifdef NW_HAVE_X86_DISPATCH
+  static const int level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse4.1") ? 1 : 0;
+#else
+  static const int level = 0;
+#endif
+  std::size_t group = level == 2 ? 32 : 16;
+  for (std::size_t first = 0; first < pairs.size(); ) {
+    std::size_t M = 0, N = 0;
+    for (std::size_t k = first; k < std::min(pairs.size(), first + group); k++) {
+      M = std::max(M, pairs[k].seq1->size());
+      N = std::max(N, pairs[k].seq2->size());
+    }
+    bool narrow = nw_batch_fits_int8(M, N);
+    std::size_t count = std::min(pairs.size() - first, narrow ? group : group / 2);
+    const SeqPair* p = &pairs[first];
+    int* s = &scores[first];
+    Traceback* t = tbs ? &(*tbs)[first] : NULL;
+    if (M + N > 16000) {
+      for (std::size_t k = 0; k < count; k++) {
+        s[k] = nw_align(*p[k].seq1, *p[k].seq2, t ? &t[k] : NULL);
+      }
+    }
+#ifdef NW_HAVE_X86_DISPATCH
+    else if (level == 2) nw_batch_avx2(p, count, s, t, narrow);
+    else if (level == 1) nw_batch_sse41(p, count, s, t, narrow);
+#endif
+    else nw_batch_generic(p, count, s, t, narrow);
+    first += count;
+  }
+}
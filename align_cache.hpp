@@ -0,0 +1,118 @@
+// align_cache.hpp : a bounded cache of gapped alignments shared by the
+// query threads.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// What a gapped alignment depends on: the read, known by a 64-bit hash
+// and its length, and the genome window, known by where it starts, how
+// long it is and the strand. Only valid within one Blast_DB. Reads whose
+// hashes collide share a key; the cache tells them apart by sequence.
+struct AlignmentKey {
+  std::uint64_t read_hash;
+  std::uint64_t genome_pos;
+  std::uint32_t read_length;
+  std::uint32_t window;  // window length << 1 | reverse
+
+  bool operator==(AlignmentKey const& o) const {
+    return read_hash == o.read_hash && genome_pos == o.genome_pos &&
+           read_length == o.read_length && window == o.window;
+  }
+};
+
+struct AlignmentKeyHash {
+  std::size_t operator()(AlignmentKey const& k) const noexcept {
+    std::uint64_t h = k.read_hash ^ (k.genome_pos * 0x9E3779B97F4A7C15ull) ^
+                      ((std::uint64_t(k.read_length) << 32 | k.window) * 0xC2B2AE3D27D4EB4Full);
+    return h ^ (h >> 29);
+  }
+};
+
+inline std::uint64_t hash_read(std::string_view read) {
+  return std::hash<std::string_view>()(read);
+}
+
+// Scores and CIGARs by AlignmentKey, dropping the least recently used
+// once about budget bytes are held, list and map nodes included. The
+// gapped strings are rebuilt from the CIGAR (expand_cigar), so they cost
+// nothing here. Keys are spread over STRIPES separately locked LRU lists,
+// so threads rarely wait on each other. Each entry keeps its read and a
+// lookup hits only on the same sequence, so a hit is exactly what the
+// aligner returned for the same pair and never changes output.
+class AlignmentCache {
+ public:
+  explicit AlignmentCache(std::size_t budget) : stripe_budget_(budget / STRIPES) { }
+
+  AlignmentCache(AlignmentCache const&) = delete;
+  AlignmentCache& operator=(AlignmentCache const&) = delete;
+
+  // read is the forward-strand read key was made from.
+  bool find(AlignmentKey const& key, std::string_view read, int& score, std::string& cigar) {
+    Stripe& s = stripe(key);
+    std::lock_guard<std::mutex> lock(s.lock);
+    auto it = s.index.find(key);
+    if (it == s.index.end() || it->second->read != read) return false;
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    score = it->second->score;
+    cigar = it->second->cigar;
+    return true;
+  }
+
+  // A key already held keeps its entry, even for a colliding read.
+  void insert(AlignmentKey const& key, std::string_view read, int score, std::string const& cigar) {
+    std::size_t bytes = entry_bytes(read, cigar);
+    if (bytes > stripe_budget_) return;
+    Stripe& s = stripe(key);
+    std::lock_guard<std::mutex> lock(s.lock);
+    if (s.index.count(key)) return;
+    while (s.bytes + bytes > stripe_budget_) {
+      Entry const& old = s.lru.back();
+      s.bytes -= entry_bytes(old.read, old.cigar);
+      s.index.erase(old.key);
+      s.lru.pop_back();
+    }
+    s.lru.push_front(Entry{ key, std::string(read), score, cigar });
+    s.index.emplace(key, s.lru.begin());
+    s.bytes += bytes;
+  }
+
+  std::size_t budget() const { return stripe_budget_ * STRIPES; }
+
+ private:
+  static const std::size_t STRIPES = 64;
+
+  struct Entry {
+    AlignmentKey key;
+    std::string read;
+    int score;
+    std::string cigar;
+  };
+
+  struct Stripe {
+    std::mutex lock;
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<AlignmentKey, std::list<Entry>::iterator, AlignmentKeyHash> index;
+    std::size_t bytes = 0;
+  };
+
+  // An entry's list node, map node and bucket, its read and its CIGAR.
+  static std::size_t entry_bytes(std::string_view read, std::string const& cigar) {
+    return sizeof(Entry) + 2 * sizeof(void*) + sizeof(AlignmentKey) + 4 * sizeof(void*) +
+           read.size() + cigar.size();
+  }
+
+  Stripe& stripe(AlignmentKey const& key) {
+    return stripes_[(AlignmentKeyHash()(key) * 0x9E3779B97F4A7C15ull) >> 58];
+  }
+
+  std::size_t stripe_budget_;
+  Stripe stripes_[STRIPES];
+};
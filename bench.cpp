@@ -0,0 +1,366 @@
+#include "UnorderedMap.hpp"
+#include "align.hpp"
+#include "align_cache.hpp"
+#include "align_banded.hpp"
+#include "align_batch.hpp"
+#include "blast.hpp"
+#include "kmer.hpp"
+#include "query.hpp"
+#include "seed_index.hpp"
+#include "seq_reader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+Microbenchmarks for the hot paths plus an end-to-end q3 run over
+sample_hw_dataset.txt. Every input comes from a fixed seed, each benchmark
+runs its warmup passes before the timed repetitions, and results are
+printed as a table and optionally written as JSON.
+*/
+
+#ifndef BENCH_DATA_DIR
+#define BENCH_DATA_DIR "src"
+#endif
+
+using bench_clock = std::chrono::steady_clock;
+
+struct BenchConfig {
+	int warmup = 3;
+	int reps = 20;
+	std::uint64_t seed = 42;
+	std::size_t genome_size = 1000000;
+	std::string genome;
+	std::string reads = BENCH_DATA_DIR "/sample_hw_dataset.txt";
+	std::string json;
+	std::string filter;
+};
+
+struct BenchResult {
+	std::string name;
+	std::size_t items;           // work units per repetition
+	std::vector<double> ns;      // one entry per repetition, sorted
+};
+
+// Keeps benchmark results observable so the work is not optimized away.
+static volatile std::uint64_t bench_sink;
+
+static double percentile(std::vector<double> const& sorted, double p) {
+	std::size_t rank = static_cast<std::size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+class BenchRunner {
+public:
+	explicit BenchRunner(BenchConfig const& config) : config_(config) { }
+
+	// Whether --filter lets the benchmark called name run; setup only some
+	// benchmarks need can check this first.
+	bool selected(std::string const& name) const {
+		return config_.filter.empty() || name.find(config_.filter) != std::string::npos;
+	}
+
+	// f runs one repetition and returns something derived from its output.
+	void run(std::string const& name, std::size_t items, std::function<std::uint64_t()> const& f) {
+		if (!selected(name)) return;
+		for (int i = 0; i < config_.warmup; i++) bench_sink = f();
+		BenchResult r{ name, items, {} };
+		for (int i = 0; i < config_.reps; i++) {
+			auto t0 = bench_clock::now();
+			bench_sink = f();
+			auto t1 = bench_clock::now();
+			r.ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+		}
+		std::sort(r.ns.begin(), r.ns.end());
+		print(r);
+		results_.push_back(std::move(r));
+	}
+
+	void write_json(std::ostream& out) const {
+		out.precision(12);
+		out << "{\n  \"config\": {\"seed\": " << config_.seed << ", \"warmup\": " << config_.warmup
+		    << ", \"reps\": " << config_.reps << ", \"genome_size\": " << config_.genome_size
+		    << ", \"isa\": \"" << isa() << "\", \"compiler\": \"" << __VERSION__ << "\""
+#ifdef NDEBUG
+		    << ", \"assertions\": false"
+#else
+		    << ", \"assertions\": true"
+#endif
+		    << "},\n  \"benchmarks\": [";
+		const char* sep = "\n";
+		for (BenchResult const& r : results_) {
+			double mean = 0;
+			for (double v : r.ns) mean += v;
+			mean /= r.ns.size();
+			out << sep << "    {\"name\": \"" << r.name << "\", \"items\": " << r.items
+			    << ", \"reps\": " << r.ns.size()
+			    << ", \"min_ns\": " << r.ns.front() << ", \"mean_ns\": " << mean
+			    << ", \"p50_ns\": " << percentile(r.ns, 50) << ", \"p90_ns\": " << percentile(r.ns, 90)
+			    << ", \"p99_ns\": " << percentile(r.ns, 99) << ", \"max_ns\": " << r.ns.back()
+			    << ", \"items_per_sec\": " << r.items / (percentile(r.ns, 50) * 1e-9) << "}";
+			sep = ",\n";
+		}
+		out << "\n  ]\n}\n";
+	}
+
+	static const char* isa() {
+#ifdef NW_HAVE_X86_DISPATCH
+		if (__builtin_cpu_supports("avx2")) return "avx2";
+		if (__builtin_cpu_supports("sse4.1")) return "sse4.1";
+#endif
+		return "generic";
+	}
+
+private:
+	// The table goes to stderr when the JSON takes stdout.
+	void print(BenchResult const& r) const {
+		std::FILE* out = config_.json == "-" ? stderr : stdout;
+		std::fprintf(out, "%-24s p50 %10.3f ms  p90 %10.3f ms  p99 %10.3f ms  %14.0f items/s\n", r.name.c_str(),
+		             percentile(r.ns, 50) * 1e-6, percentile(r.ns, 90) * 1e-6,
+		             percentile(r.ns, 99) * 1e-6, r.items / (percentile(r.ns, 50) * 1e-9));
+		std::fflush(out);
+	}
+
+	BenchConfig const& config_;
+	std::vector<BenchResult> results_;
+};
+
+static std::string random_bases(std::mt19937_64& rng, std::size_t n) {
+	static const char bases[] = "ACGT";
+	std::string s(n, 'A');
+	for (char& c : s) c = bases[rng() & 3];
+	return s;
+}
+
+// Copies of a base with about one substitution in rate positions.
+static std::string mutate(std::mt19937_64& rng, std::string s, unsigned rate) {
+	static const char bases[] = "ACGT";
+	for (char& c : s) {
+		if (rng() % rate == 0) c = bases[rng() & 3];
+	}
+	return s;
+}
+
+static void bench_kmers(BenchRunner& b, std::string const& genome) {
+	const int k = DEFAULT_WORD_SIZE;
+	b.run("kmer_encode", genome.size(), [&] {
+		KmerEncoder enc(k);
+		std::uint64_t sum = 0;
+		for (char c : genome) {
+			if (enc.push(c)) sum += enc.value();
+		}
+		return sum;
+	});
+
+	std::vector<kmer_t> keys;
+	KmerEncoder enc(k);
+	for (std::size_t i = 0; i < genome.size() && keys.size() < 200000; i++) {
+		if (enc.push(genome[i])) keys.push_back(enc.value());
+	}
+	b.run("kmer_hash_insert_find", keys.size(), [&] {
+		UnorderedMapPool map;
+		for (kmer_t key : keys) map[key] += 1;
+		std::uint64_t sum = 0;
+		for (kmer_t key : keys) sum += map.find(key)->second;
+		return sum;
+	});
+}
+
+// Builds and probes a SeedIndex<K>. Past SEED_DIRECT_BASES lookups add a
+// binary search within a bucket. Random keys mostly miss a small genome,
+// which is what the presence filter is for.
+template <int K>
+static void bench_index(BenchRunner& b, std::string const& genome, std::mt19937_64& rng,
+                        std::string const& suffix) {
+	b.run("index_build" + suffix, genome.size(), [&] {
+		SeedIndex<K> index;
+		index.build(genome);
+		return std::uint64_t(index.size());
+	});
+
+	// The probed index is only built when a lookup benchmark will run.
+	if (!b.selected("index_lookup" + suffix) && !b.selected("index_probe" + suffix)) return;
+	SeedIndex<K> index;
+	index.build(genome);
+	std::vector<typename SeedIndex<K>::key_type> queries(1000000);
+	for (auto& q : queries) q = static_cast<typename SeedIndex<K>::key_type>(rng() & kmer_mask(K));
+	b.run("index_lookup" + suffix, queries.size(), [&] {
+		std::uint64_t sum = 0;
+		for (auto q : queries) sum += index.lookup(q).size();
+		return sum;
+	});
+	// The same lookups without the presence filter in front.
+	b.run("index_probe" + suffix, queries.size(), [&] {
+		std::uint64_t sum = 0;
+		for (auto q : queries) sum += index.probe(q).size();
+		return sum;
+	});
+}
+
+static void bench_align(BenchRunner& b, std::mt19937_64& rng) {
+	const std::size_t pairs_count = 1024;
+	std::vector<std::string> as, bs;
+	for (std::size_t i = 0; i < pairs_count; i++) {
+		as.push_back(random_bases(rng, 50));
+		bs.push_back(mutate(rng, as.back(), 10));
+	}
+
+	typedef int (*kernel)(const char*, std::size_t, const char*, std::size_t, Traceback*,
+	                      std::vector<std::vector<int>>*);
+	struct Named { const char* name; kernel f; };
+	std::vector<Named> kernels = { { "align_scalar", nw_align_scalar }, { "align_generic", nw_align_generic } };
+#ifdef NW_HAVE_X86_DISPATCH
+	if (__builtin_cpu_supports("sse4.1")) kernels.push_back({ "align_sse41", nw_align_sse41 });
+	if (__builtin_cpu_supports("avx2")) kernels.push_back({ "align_avx2", nw_align_avx2 });
+#endif
+	for (Named const& kn : kernels) {
+		b.run(kn.name, pairs_count, [&] {
+			std::uint64_t sum = 0;
+			Traceback tb;
+			for (std::size_t i = 0; i < pairs_count; i++) {
+				sum += kn.f(as[i].data(), as[i].size(), bs[i].data(), bs[i].size(), &tb, NULL);
+			}
+			return sum;
+		});
+	}
+
+	b.run("align_banded_w8", pairs_count, [&] {
+		std::uint64_t sum = 0;
+		BandedTraceback tb;
+		for (std::size_t i = 0; i < pairs_count; i++) sum += nw_align_adaptive(as[i], bs[i], 0, 8, &tb);
+		return sum;
+	});
+
+	std::vector<SeqPair> pairs;
+	for (std::size_t i = 0; i < pairs_count; i++) pairs.push_back({ &as[i], &bs[i] });
+	b.run("align_batch", pairs_count, [&] {
+		std::vector<int> scores;
+		std::vector<Traceback> tbs;
+		nw_align_batch(pairs, scores, &tbs);
+		std::uint64_t sum = 0;
+		for (int s : scores) sum += s;
+		return sum;
+	});
+}
+
+// Single-threaded q3 over the reads: seeding, filters, batched alignment
+// and formatting, with the output discarded. A cached mode starts every
+// repetition with an empty alignment cache. The genome is indexed only if
+// a mode is selected.
+static void bench_end_to_end(BenchRunner& b, std::string const& genome, std::vector<ReadBatch> const& batches,
+                             std::size_t reads) {
+	struct Mode { const char* name; OutputFormat format; ExtendParams params; bool cached; };
+	ExtendParams plain, filtered, banded;
+	filtered.min_ungapped = 30;
+	banded.band = 8;
+	Mode modes[] = {
+		{ "e2e_q3_human", FORMAT_HUMAN, plain, false },
+		{ "e2e_q3_paf", FORMAT_PAF, plain, false },
+		{ "e2e_q3_ungapped30", FORMAT_HUMAN, filtered, false },
+		{ "e2e_q3_band8", FORMAT_HUMAN, banded, false },
+		{ "e2e_q3_cached", FORMAT_HUMAN, plain, true },
+	};
+	if (std::none_of(std::begin(modes), std::end(modes), [&](Mode const& m) { return b.selected(m.name); })) {
+		return;
+	}
+	Blast_DB<DEFAULT_WORD_SIZE> db(genome);
+	db.store_polymers();
+	for (Mode const& m : modes) {
+		b.run(m.name, reads, [&] {
+			std::uint64_t bytes = 0;
+			std::unique_ptr<AlignmentCache> cache(m.cached ? new AlignmentCache(std::size_t(64) << 20) : NULL);
+			for (ReadBatch const& batch : batches) {
+				bytes += ProcessBatch(db, batch, m.params, m.format, false, cache.get()).text.size();
+			}
+			return bytes;
+		});
+	}
+}
+
+int main(int argc, char* argv[]) {
+	BenchConfig config;
+	for (int i = 1; i < argc; i++) {
+		auto value = [&]() -> const char* {
+			if (i + 1 >= argc) {
+				std::cerr << argv[i] << " needs a value\n";
+				std::exit(1);
+			}
+			return argv[++i];
+		};
+		if (strcmp(argv[i], "--reps") == 0) config.reps = std::max(1, atoi(value()));
+		else if (strcmp(argv[i], "--warmup") == 0) config.warmup = std::max(0, atoi(value()));
+		else if (strcmp(argv[i], "--seed") == 0) config.seed = std::strtoull(value(), NULL, 10);
+		else if (strcmp(argv[i], "--genome-size") == 0) config.genome_size = std::strtoull(value(), NULL, 10);
+		else if (strcmp(argv[i], "--genome") == 0) config.genome = value();
+		else if (strcmp(argv[i], "--reads") == 0) config.reads = value();
+		else if (strcmp(argv[i], "--json") == 0) config.json = value();
+		else if (strcmp(argv[i], "--filter") == 0) config.filter = value();
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--reps N] [--warmup N] [--seed S] [--genome-size N]"
+			          << " [--genome genome.fa] [--reads reads.txt] [--filter NAME] [--json out.json]\n";
+			return 1;
+		}
+	}
+
+	std::mt19937_64 rng(config.seed);
+	ReadBatch all;
+	SeqReader reader(config.reads);
+	while (reader.next_batch(all, READ_BATCH)) { }
+
+	// Without --genome, a random genome with every read planted once,
+	// lightly mutated, so the end-to-end run finds real hits.
+	std::string genome;
+	if (!config.genome.empty()) {
+		genome = read_sequence(config.genome);
+	} else {
+		genome = random_bases(rng, config.genome_size);
+		for (std::string const& read : all.seqs) {
+			if (read.size() >= genome.size()) continue;
+			std::size_t pos = rng() % (genome.size() - read.size());
+			genome.replace(pos, read.size(), mutate(rng, read, 25));
+		}
+	}
+	config.genome_size = genome.size();
+
+	std::vector<ReadBatch> batches;
+	for (std::size_t i = 0; i < all.size(); i += READ_BATCH) {
+		batches.emplace_back();
+		std::size_t end = std::min(all.size(), i + READ_BATCH);
+		batches.back().names.assign(all.names.begin() + i, all.names.begin() + end);
+		batches.back().seqs.assign(all.seqs.begin() + i, all.seqs.begin() + end);
+	}
+
+	BenchRunner b(config);
+	bench_kmers(b, genome);
+	bench_index<DEFAULT_WORD_SIZE>(b, genome, rng, "");
+	bench_index<20>(b, genome, rng, "_k20");
+	bench_align(b, rng);
+
+	bench_end_to_end(b, genome, batches, all.size());
+
+	if (!config.json.empty()) {
+		if (config.json == "-") {
+			b.write_json(std::cout);
+		} else {
+			std::ofstream out(config.json);
+			if (!out) {
+				std::cerr << "Could not create " << config.json << '\n';
+				return 1;
+			}
+			b.write_json(out);
+		}
+	}
+	return 0;
+}
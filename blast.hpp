@@ -1,224 +1,492 @@
+#pragma once
+
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <memory>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
-class Blast_DB {
- public:
-  Blast_DB(std::string genome)
-      : genome_(std::move(genome)), seed_pos(10'000'000) {
-    
-  }
+#include "align.hpp"
+#include "align_banded.hpp"
+#include "align_batch.hpp"
+#include "contigs.hpp"
+#include "kmer.hpp"
+#include "mapped_file.hpp"
+#include "seed_index.hpp"
+#include "spaced_seed.hpp"
 
-  ~Blast_DB() = default;
+// On-disk layout written by Blast_DB::save: this header, then the packed
+// genome, the seed offsets, the seed positions, for word sizes over
+// SEED_DIRECT_BASES the seed suffixes, then the contig starts and names
+// and the presence filter bits, each starting on a 64-byte boundary. Integers are stored in host byte
+// order. A sharded index is one such file per shard: the path given for
+// shard 0, "<path>.<n>" for shard n. Sequences appended later go to a
+// delta segment, "<path>.delta", flagged INDEX_DELTA, until compacted.
+struct IndexFileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t word_size;
+  std::uint64_t genome_length;
+  std::uint64_t genome_offset;
+  std::uint64_t offsets_offset;
+  std::uint64_t offsets_count;
+  std::uint64_t positions_offset;
+  std::uint64_t positions_count;
+  std::uint32_t flags;     // INDEX_CANONICAL; version 2 on
+  std::uint32_t window;    // minimizer window; 0 or 1 files every k-mer
+  std::uint64_t contigs_offset;  // contigs_count uint64 starts; version 3 on
+  std::uint64_t contigs_count;
+  std::uint64_t names_offset;    // contig names, each ended by '\0'
+  std::uint64_t names_bytes;
+  std::uint32_t shard;
+  std::uint32_t shards;
+  std::uint64_t delta_base;  // bases of the index a delta segment follows; version 4 on
+  std::uint64_t presence_offset;  // PresenceFilter bits; version 5 on
+  std::uint64_t presence_bytes;
+};
+
+static const char INDEX_MAGIC[8] = {'G', 'N', 'M', 'I', 'D', 'X', '\0', '\0'};
+static const std::uint32_t INDEX_VERSION = 5;
+static const std::uint32_t INDEX_CANONICAL = 1;
+static const std::uint32_t INDEX_DELTA = 2;
+// Version 1 headers end before flags and are read as forward-only;
+// version 2 headers end before the contigs and are read as one unsharded
+// contig named DEFAULT_CONTIG_NAME; version 3 headers end before
+// delta_base and are never deltas; version 4 headers end before the
+// presence filter, which is rebuilt from the table on open.
+static const std::size_t INDEX_V1_HEADER_SIZE = 64;
+static const std::size_t INDEX_V2_HEADER_SIZE = 72;
+static const std::size_t INDEX_V3_HEADER_SIZE = 112;
+static const std::size_t INDEX_V4_HEADER_SIZE = 120;
+
+// The spaced seeds store_spaced_seeds indexes: two weight-11 patterns of
+// span 18 and 17, where the contiguous index uses one 11-mer.
+typedef SpacedSeedIndex<0b111010010100110111, 0b11011000110101111> SpacedSeeds;
 
-  auto& table() { return seed_pos; }
+// Word sizes a Blast_DB can be built for; with_word_size instantiates the
+// query path once for each.
+static const int DEFAULT_WORD_SIZE = 11;
+static const int MIN_WORD_SIZE = 8;
+static const int MAX_WORD_SIZE = 32;
 
+// Everything in Blast_DB that does not depend on the word size.
+class Blast_Base {
+ public:
   struct data {
-    std::string polymer;
+    kmer_t polymer;
     std::size_t query_index;
     std::size_t genome_index;
   };
-  static const int WORD_SIZE = 11;
 
- private:
-  UnorderedMapPool seed_pos;
-  std::vector<data> stk;
-  std::string genome_;
+  struct alignment {
+    int score;
+    std::string seq1;   // gapped
+    std::string seq2;   // gapped
+    std::string cigar;  // seq1 as the reference
+  };
 
-  static const int ORIGINAL_SIZE = 50;
+  // Globally aligns seq1 against seq2 with the vectorized kernel in
+  // align.hpp, keeping only a 2-bit traceback.
+  static alignment align(std::string const& seq1, std::string const& seq2) {
+    alignment result;
+    Traceback tb;
+    result.score = nw_align(seq1, seq2, &tb);
+    trace_alignment(tb, seq1, seq2, result.seq1, result.seq2, &result.cigar);
+    return result;
+  }
 
- public:
-  static auto traceback_alignment(
-      std::vector<std::vector<std::string>> traceback_array,
-      std::string seq1,
-      std::string seq2,
-      std::string up_arrow = "↑",
-      std::string left_arrow = "←",
-      std::string up_left_arrow = "🡔",
-      std::string stop = "-") {
-    /*Align seq1 and seq2 using the traceback matrix and return as two strings
-
-    traceback_array -- a numpy array with arrow characters indicating the
-    direction from
-    which the best path to a given alignment position originated
-
-    seq1 - a sequence represented as a string
-    seq2 - a sequence represented as a string
-    up_arrow - the unicode used for the up arrows (there are several arrow
-    symbols in Unicode)
-    left_arrow - the unicode used for the left arrows
-    up_left_arrow - the unicode used for the diagonal arrows
-    stop - the symbol used in the upper left to indicate the end of the
-    alignment
-    */
-
-    auto n_rows = seq1.size() + 1;     // need an extra row up top
-    auto n_columns = seq2.size() + 1;  // need an extra row up top
-
-    auto row = seq1.size();
-    auto col = seq2.size();
-    auto arrow = traceback_array[row][col];
-    std::string aligned_seq1 = "";
-    std::string aligned_seq2 = "";
-    std::string alignment_indicator = "";
-    while (arrow != "-") {
-      arrow = traceback_array[row][col];
-
-      if (arrow == up_arrow) {
-        // We want to add the new indel onto the left
-        // side of the growing aligned sequence
-        aligned_seq2 = "-" + aligned_seq2;
-        aligned_seq1 = seq1[row - 1] + aligned_seq1;
-        alignment_indicator = " " + alignment_indicator;
-        row -= 1;
-      } else if (arrow == up_left_arrow) {
-        // Note that we look up the row-1 and col-1 indexes
-        // because there is an extra "-" character at the
-        // start of each sequence
-        auto seq1_character = seq1[row - 1];
-        auto seq2_character = seq2[col - 1];
-        aligned_seq1 = seq1[row - 1] + aligned_seq1;
-        aligned_seq2 = seq2[col - 1] + aligned_seq2;
-        if (seq1_character == seq2_character)
-          alignment_indicator = "|" + alignment_indicator;
-        else
-          alignment_indicator = " " + alignment_indicator;
-        row -= 1;
-        col -= 1;
-      } else if (arrow == left_arrow) {
-        aligned_seq1 = "-" + aligned_seq1;
-        aligned_seq2 = seq2[col - 1] + aligned_seq2;
-        alignment_indicator = " " + alignment_indicator;
-        col -= 1;
-      } else if (arrow == stop)
-        break;
-      else {
-        auto s="Traceback array entry at " + std::to_string(row) + "," + std::to_string(col) + ": " + arrow + " is not recognized "
-            "as an up arrow " + (up_arrow) + ",left_arrow " + (left_arrow) + ", "
-            "up_left_arrow " + (up_left_arrow) + ", or a stop " + (stop) + ".";
-        std::cerr << s << std::endl;
-        throw std::invalid_argument("Error");
-      }
+  // align() for many pairs at once, one pair per SIMD lane
+  // (align_batch.hpp). Results come back in the order of pairs.
+  static std::vector<alignment> align_batch(std::vector<SeqPair> const& pairs) {
+    std::vector<int> scores;
+    std::vector<Traceback> tbs;
+    nw_align_batch(pairs, scores, &tbs);
+    std::vector<alignment> results(pairs.size());
+    for (std::size_t k = 0; k < pairs.size(); k++) {
+      results[k].score = scores[k];
+      trace_alignment(tbs[k], *pairs[k].seq1, *pairs[k].seq2,
+                      results[k].seq1, results[k].seq2, &results[k].cigar);
     }
-    
-    return std::make_pair(aligned_seq1, aligned_seq2);
+    return results;
   }
 
-  static auto query(std::string const& seq1, std::string const& seq2, vector<vector<int>>* s = 0, vector<vector<std::string>>* t = 0) {
-    // build an array of zeroes
-    // seq1 = "GCTGATTC"
-    // seq2 = "GATCTGATTA"
-    auto n_rows = 1 + seq1.size();
-    auto n_columns = 1 + seq2.size();
+  // align() limited to a band of half-width w around diagonal diag
+  // (seq2 index minus seq1 index), widened and retried while the best path
+  // hits the band edge. Costs O(m * w) time and memory instead of O(m * n).
+  static alignment align_banded(std::string const& seq1, std::string const& seq2,
+                                std::ptrdiff_t diag, std::size_t w) {
+    alignment result;
+    BandedTraceback tb;
+    result.score = nw_align_adaptive(seq1, seq2, diag, w, &tb);
+    trace_alignment(tb, seq1, seq2, result.seq1, result.seq2, &result.cigar);
+    return result;
+  }
 
-    std::vector<std::vector<int>> scoring_array(n_rows, std::vector<int>(n_columns, 0));
-    std::vector<std::vector<std::string>> traceback_array(n_rows, std::vector<std::string>(n_columns, "-"));
+  // Same alignment as align(), returned as (score, (seq1, seq2)). s and t
+  // receive the score matrix and an arrow matrix for the q4 debug view.
+  static auto query(std::string const& seq1, std::string const& seq2, std::vector<std::vector<int>>* s = 0, std::vector<std::vector<std::string>>* t = 0) {
+    Traceback tb;
+    int score = nw_align(seq1, seq2, &tb, s);
 
-    int count = 0;
-    for (int i = 0; i < n_rows; i++) {
-      for (int j = 0; j < n_columns; j++) {
-        scoring_array[i][j] = count;
-        count += 1;
+    if (t) {
+      static const char* const arrows[] = {"-", "←", "↑", "🡔"};
+      t->assign(seq1.size() + 1, std::vector<std::string>(seq2.size() + 1));
+      for (std::size_t row = 0; row <= seq1.size(); row++) {
+        for (std::size_t col = 0; col <= seq2.size(); col++) {
+          (*t)[row][col] = arrows[tb.at(row, col)];
+        }
       }
     }
 
-    // pretty_table_from_array(scoring_array, row_labels, column_labels)
-
-    std::string up_arrow = "↑";
-    std::string right_arrow = "→";
-    std::string down_arrow = "↓";
-    std::string left_arrow = "←";
-    std::string down_right_arrow = "🡖";
-    std::string up_left_arrow = "🡔";
- 
-    // build an array of zeroes
-    n_rows = seq1.size() + 1;     // need an extra row up top
-    n_columns = seq2.size() + 1;  // need an extra column on the left
-
-    scoring_array.clear();
-    scoring_array.resize(n_rows, std::vector<int>(n_columns, 0));
-    traceback_array.clear();
-    traceback_array.resize(n_rows, std::vector<std::string>(n_columns, "-"));
-
-    std::string arrow = "-";
-    int gap_penalty = -1;
-    int match_bonus = 2;
-    int mismatch_penalty = -1;
-
-    int score = 0;
-    int previous_score = 0;
-
-    int cell_to_the_left = 0;
-    int from_left_score = 0;
-    int above_cell = 0;
-    int from_above_score = 0;
-    int diagonal_left_cell = 0;
-    int diagonal_left_cell_score = 0;
-    // iterate over columns first because we want to do
-    // all the columns for row 1 before row 2
-    int row = 0,col = 0;
-    for (row = 0; row < n_rows; row++) {
-      for (col = 0; col < n_columns; col++) {
-        if (row == 0 && col == 0) {
-          score = 0;
-          arrow = "-";
-        } else if (row == 0) {
-          previous_score = scoring_array.at(row).at(col - 1);
-          
-          score = previous_score + gap_penalty;
-          arrow = left_arrow;
-        } else if (col == 0) {
-          // We're on the first column but not in the first row
-          previous_score = scoring_array.at(row - 1).at(col);
-          score = previous_score + gap_penalty;
-          arrow = up_arrow;
-          
-        } else {
-          cell_to_the_left = scoring_array.at(row).at(col - 1);
-          from_left_score = cell_to_the_left + gap_penalty;
-
-          above_cell = scoring_array.at(row - 1).at(col);
-          from_above_score = above_cell + gap_penalty;
-
-          diagonal_left_cell = scoring_array.at(row - 1).at(col - 1);
-
-          if (seq1.at(row - 1) == seq2.at(col - 1))
-            diagonal_left_cell_score = diagonal_left_cell + match_bonus;
-          else
-            diagonal_left_cell_score = diagonal_left_cell + mismatch_penalty;
-
-          score = std::max(
-              {from_left_score, from_above_score, diagonal_left_cell_score});
-              
-          if (score == from_left_score)
-            arrow = left_arrow;
-          else if (score == from_above_score)
-            arrow = up_arrow;
-          else if (score == diagonal_left_cell_score)
-            arrow = up_left_arrow;
-        }
-        traceback_array.at(row).at(col) = arrow;
-        scoring_array.at(row).at(col) = score;
-      }
+    std::pair<std::string, std::string> aligned;
+    trace_alignment(tb, seq1, seq2, aligned.first, aligned.second);
+    return std::make_pair(score, aligned);
+  }
+
+  static bool is_index_file(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof INDEX_MAGIC] = {};
+    in.read(magic, sizeof magic);
+    return in && std::memcmp(magic, INDEX_MAGIC, sizeof magic) == 0;
+  }
+
+  // The word size an index file was built with, to pick the Blast_DB to
+  // open it with.
+  static int index_word_size(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    IndexFileHeader h;
+    in.read(reinterpret_cast<char*>(&h), INDEX_V1_HEADER_SIZE);
+    if (!in || std::memcmp(h.magic, INDEX_MAGIC, sizeof h.magic) != 0) {
+      throw std::runtime_error(path + " is not an index file");
+    }
+    return static_cast<int>(h.word_size);
+  }
+
+  // Records the shard count in an index file save() wrote, for writers
+  // that only know it once the last shard is done.
+  static void set_index_shards(std::string const& path, std::uint32_t shards) {
+    std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+    f.seekp(offsetof(IndexFileHeader, shards));
+    f.write(reinterpret_cast<const char*>(&shards), sizeof shards);
+    if (!f) {
+      throw std::runtime_error("Could not write " + path);
     }
+  }
 
-    if (s) *s = scoring_array;
-    if (t) *t = traceback_array;
+ protected:
+  static std::uint64_t align_up(std::uint64_t n) { return (n + 63) & ~std::uint64_t(63); }
+};
 
-    return std::make_pair(scoring_array[row-1][col-1], traceback_alignment(traceback_array, seq1, seq2));
-    //return traceback_alignment(traceback_array, scoring_array, seq1, seq2);
+// The genome, packed 2 bits per base, and its index of every K-mer. K is
+// fixed at compile time so the k-mer loops unroll and keys take key_type;
+// with_word_size picks the instantiation at run time.
+template <int K>
+class Blast_DB : public Blast_Base {
+ public:
+  static const int WORD_SIZE = K;
+  typedef SeedIndex<K> index_type;
+  typedef typename index_type::key_type key_type;
+
+  // canonical builds one index for both strands, and window > 1 files
+  // only (window, K)-minimizers (see SeedIndex). No seed spans two
+  // contigs.
+  Blast_DB(std::string genome, ContigTable contigs, bool canonical = false, int window = 1)
+      : index_(canonical, window), genome_(std::move(genome)), contigs_(std::move(contigs)) {
+    packed_ = pack_sequence(genome_);
+    packed_view_ = packed_.data();
+    length_ = genome_.size();
   }
 
-  void store_polymers() {
-    UnorderedMapPool found;
-    for (int i = 0; i < genome_.size(); i++) {
-      std::string word = genome_.substr(i, WORD_SIZE);
-      if (word.size() == WORD_SIZE && found[word] == 0) {
-        found[word] = 1;
-        seed_pos[word] = i - WORD_SIZE;
-      }
+  // A genome of one contig, named DEFAULT_CONTIG_NAME.
+  Blast_DB(std::string genome, bool canonical = false, int window = 1)
+      : Blast_DB(std::move(genome), ContigTable(), canonical, window) {
+    contigs_ = ContigTable::single(length_);
+  }
+
+  Blast_DB(Blast_DB&&) = default;
+  Blast_DB& operator=(Blast_DB&&) = default;
+  ~Blast_DB() = default;
+
+  index_type const& index() const { return index_; }
+
+  // Every genome position where word starts, ascending. A canonical
+  // index also returns the positions of word's reverse complement; see
+  // reverse_strand.
+  position_span seeds(kmer_t word) const { return index_.lookup(index_.key(word)); }
+
+  bool canonical() const { return index_.canonical(); }
+
+  // Filed positions per genome k-mer position: 1 for a full index, about
+  // minimizer_density(window) for a sampled one.
+  double density() const {
+    return length_ >= std::size_t(K) ? double(index_.size()) / double(length_ - K + 1) : 0.0;
+  }
+
+  // The K-mer starting at genome[pos].
+  key_type kmer_at(std::size_t pos) const {
+    key_type v = 0;
+    for (int i = 0; i < K; i++) v = (v << 2) | base(pos + i);
+    return v;
+  }
+
+  // True when a seed hit at pos for word matched its reverse complement,
+  // i.e. the read lies on the reverse strand there.
+  bool reverse_strand(kmer_t word, std::size_t pos) const {
+    return index_.canonical() && kmer_at(pos) != word;
+  }
+
+  std::size_t size() const { return length_; }
+
+  // The contigs of this genome, or of this shard of a sharded reference.
+  ContigTable const& contigs() const { return contigs_; }
+  // Which shard of a sharded index this is, and how many there are.
+  unsigned shard() const { return shard_; }
+  unsigned shards() const { return shards_; }
+
+  // A delta segment holds sequences appended to a reference of
+  // delta_base() bases, indexed on their own until compacted into it.
+  bool delta() const { return delta_; }
+  std::size_t delta_base() const { return delta_base_; }
+  void set_delta(std::size_t base) {
+    delta_ = true;
+    delta_base_ = base;
+  }
+
+  // 2-bit code of genome[pos] (see kmer.hpp).
+  unsigned base(std::size_t pos) const { return packed_base(packed_view_, pos); }
+
+  // genome[pos, pos + len), clipped at the end like substr.
+  std::string window(std::size_t pos, std::size_t len) const {
+    if (pos >= length_) return std::string();
+    len = std::min(len, length_ - pos);
+    std::string out(len, 'A');
+    unpack_sequence(packed_view_, pos, len, &out[0]);
+    return out;
+  }
+
+  // Writes the packed genome, the seed index and the contig table; call
+  // after store_polymers. shards of 0 leaves the count to a later
+  // set_index_shards.
+  void save(std::string const& path, unsigned shard = 0, unsigned shards = 1) const {
+    if (spaced_) {
+      throw std::runtime_error("Spaced seed indexes cannot be saved");
+    }
+    typedef typename index_type::position_type position_type;
+    IndexFileHeader h;
+    std::memset(&h, 0, sizeof h);
+    std::memcpy(h.magic, INDEX_MAGIC, sizeof h.magic);
+    h.version = INDEX_VERSION;
+    h.word_size = K;
+    h.genome_length = length_;
+    h.genome_offset = align_up(sizeof h);
+    h.offsets_offset = align_up(h.genome_offset + packed_bytes());
+    h.offsets_count = index_.slots() + 1;
+    h.positions_offset = align_up(h.offsets_offset + h.offsets_count * sizeof(position_type));
+    h.positions_count = index_.size();
+    h.flags = (index_.canonical() ? INDEX_CANONICAL : 0) | (delta_ ? INDEX_DELTA : 0);
+    h.window = index_.window() > 1 ? index_.window() : 0;
+    std::string names = contigs_.joined_names();
+    h.contigs_offset = align_up((index_type::SUFFIX > 0 ? suffixes_offset(h) : h.positions_offset) +
+                                h.positions_count * (index_type::SUFFIX > 0 ? sizeof(key_type) : sizeof(position_type)));
+    h.contigs_count = contigs_.size();
+    h.names_offset = align_up(h.contigs_offset + h.contigs_count * sizeof(std::uint64_t));
+    h.names_bytes = names.size();
+    h.shard = shard;
+    h.shards = shards;
+    h.delta_base = delta_base_;
+    h.presence_offset = align_up(h.names_offset + h.names_bytes);
+    h.presence_bytes = index_.presence().memory_bytes();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Could not create " + path);
+    }
+    auto put = [&](std::uint64_t offset, const void* data, std::size_t bytes) {
+      static const char zeros[64] = {};
+      out.write(zeros, offset - out.tellp());
+      out.write(static_cast<const char*>(data), bytes);
+    };
+    out.write(reinterpret_cast<const char*>(&h), sizeof h);
+    put(h.genome_offset, packed_view_, packed_bytes());
+    put(h.offsets_offset, index_.offsets(), h.offsets_count * sizeof(position_type));
+    put(h.positions_offset, index_.positions(), h.positions_count * sizeof(position_type));
+    if (index_type::SUFFIX > 0) {
+      put(suffixes_offset(h), index_.suffixes(), h.positions_count * sizeof(key_type));
+    }
+    put(h.contigs_offset, contigs_.starts().data(), h.contigs_count * sizeof(std::uint64_t));
+    put(h.names_offset, names.data(), names.size());
+    put(h.presence_offset, index_.presence().data(), h.presence_bytes);
+    if (!out) {
+      throw std::runtime_error("Could not write " + path);
+    }
+  }
+
+  // Maps an index written by save() read-only and serves lookups and
+  // genome windows straight from the mapping.
+  static Blast_DB open(std::string const& path) {
+    typedef typename index_type::position_type position_type;
+    MappedFile file(path);
+    IndexFileHeader h;
+    if (file.size() < INDEX_V1_HEADER_SIZE) {
+      throw std::runtime_error(path + " is not an index file");
+    }
+    std::memset(&h, 0, sizeof h);
+    std::memcpy(&h, file.data(), std::min(sizeof h, file.size()));
+    if (std::memcmp(h.magic, INDEX_MAGIC, sizeof h.magic) != 0) {
+      throw std::runtime_error(path + " is not an index file");
+    }
+    if (h.version < 1 || h.version > INDEX_VERSION) {
+      throw std::runtime_error(path + ": unsupported index version " + std::to_string(h.version));
+    }
+    if (h.version < INDEX_VERSION) {
+      std::size_t bytes = h.version == 1 ? INDEX_V1_HEADER_SIZE
+                          : h.version == 2 ? INDEX_V2_HEADER_SIZE
+                          : h.version == 3 ? INDEX_V3_HEADER_SIZE : INDEX_V4_HEADER_SIZE;
+      std::memset(reinterpret_cast<char*>(&h) + bytes, 0, sizeof h - bytes);
+    }
+    if (h.word_size != K) {
+      throw std::runtime_error(path + ": index word size " + std::to_string(h.word_size) +
+                               " does not match " + std::to_string(K));
+    }
+    std::size_t position_bytes = sizeof(position_type);
+    std::uint64_t suffix_bytes = index_type::SUFFIX > 0 ? h.positions_count * sizeof(key_type) : 0;
+    if (h.offsets_count != index_type::slots() + 1 ||
+        h.genome_offset + (h.genome_length + 3) / 4 > file.size() ||
+        h.offsets_offset + h.offsets_count * position_bytes > file.size() ||
+        h.positions_offset + h.positions_count * position_bytes > file.size() ||
+        (suffix_bytes && suffixes_offset(h) + suffix_bytes > file.size()) ||
+        h.contigs_offset + h.contigs_count * sizeof(std::uint64_t) > file.size() ||
+        h.names_offset + h.names_bytes > file.size() ||
+        h.presence_offset + h.presence_bytes > file.size()) {
+      throw std::runtime_error(path + " is truncated");
+    }
+
+    Blast_DB db;
+    db.index_ = index_type((h.flags & INDEX_CANONICAL) != 0, static_cast<int>(h.window));
+    db.length_ = h.genome_length;
+    db.packed_view_ = reinterpret_cast<const std::uint8_t*>(file.data() + h.genome_offset);
+    db.index_.attach(
+        reinterpret_cast<const position_type*>(file.data() + h.offsets_offset),
+        reinterpret_cast<const position_type*>(file.data() + h.positions_offset),
+        h.positions_count,
+        suffix_bytes ? reinterpret_cast<const key_type*>(file.data() + suffixes_offset(h)) : nullptr,
+        h.presence_bytes ? file.data() + h.presence_offset : nullptr, h.presence_bytes);
+    if (h.contigs_count == 0) {
+      db.contigs_ = ContigTable::single(h.genome_length);
+    } else {
+      db.contigs_ = ContigTable::from_file(
+          reinterpret_cast<const std::uint64_t*>(file.data() + h.contigs_offset), h.contigs_count,
+          std::string_view(file.data() + h.names_offset, h.names_bytes), h.genome_length);
     }
+    db.shard_ = h.shard;
+    db.shards_ = std::max<std::uint32_t>(1, h.shards);
+    db.delta_ = (h.flags & INDEX_DELTA) != 0;
+    db.delta_base_ = h.delta_base;
+    db.file_ = std::move(file);
+    return db;
   }
-};
\ No newline at end of file
+
+  // a's genome and contigs followed by b's, with one index merged from
+  // theirs (SeedIndex::concat): only the two tables are read, never the
+  // genomes, so a delta segment folds into a large shard in one pass over
+  // the shard's table. The result keeps a's shard number and count.
+  static Blast_DB concat(Blast_DB const& a, Blast_DB const& b) {
+    if (a.spaced_ || b.spaced_) {
+      throw std::runtime_error("Spaced seed indexes cannot be concatenated");
+    }
+    if (a.length_ + b.length_ > UINT32_MAX) {
+      throw std::length_error("Genome too large for 32-bit seed positions");
+    }
+    Blast_DB db;
+    db.index_ = index_type::concat(a.index_, b.index_, a.length_);
+    db.length_ = a.length_ + b.length_;
+    db.packed_.assign(a.packed_view_, a.packed_view_ + a.packed_bytes());
+    db.packed_.resize((db.length_ + 3) / 4, 0);
+    for (std::size_t i = 0; i < b.length_; i++) {
+      std::size_t p = a.length_ + i;
+      db.packed_[p >> 2] |= static_cast<std::uint8_t>(b.base(i) << ((p & 3) * 2));
+    }
+    db.packed_view_ = db.packed_.data();
+    db.contigs_ = a.contigs_;
+    db.contigs_.append(b.contigs_);
+    db.shard_ = a.shard_;
+    db.shards_ = a.shards_;
+    db.delta_ = a.delta_;
+    db.delta_base_ = a.delta_base_;
+    return db;
+  }
+
+  // Indexes every position of every K-mer in the genome.
+  void store_polymers(unsigned threads = 1) {
+    index_.build(genome_, threads, contigs_.breaks());
+    std::string().swap(genome_);
+  }
+
+  // Lets the kernel drop the mapped pages of an opened index, e.g. once
+  // a shard has been queried; they are read back in if touched again.
+  void release() const { file_.advise(0, file_.size(), MADV_DONTNEED); }
+
+  // Indexes the genome under every SpacedSeeds pattern, in one pass,
+  // instead of by contiguous K-mers; seeds() then finds nothing and
+  // queries go through spaced(). Forward strand only.
+  void store_spaced_seeds() {
+    spaced_.reset(new SpacedSeeds());
+    spaced_->build(genome_, contigs_.breaks());
+    std::string().swap(genome_);
+  }
+
+  // The spaced seed tables, or NULL for a contiguous index.
+  SpacedSeeds const* spaced() const { return spaced_.get(); }
+
+ private:
+  Blast_DB() = default;
+
+  std::size_t packed_bytes() const { return (length_ + 3) / 4; }
+  // Suffixes follow the positions, so no header field is needed for them.
+  static std::uint64_t suffixes_offset(IndexFileHeader const& h) {
+    return align_up(h.positions_offset + h.positions_count * sizeof(typename index_type::position_type));
+  }
+
+  index_type index_;
+  std::vector<data> stk;
+  // Source text for store_polymers; released once the index is built.
+  std::string genome_;
+  std::vector<std::uint8_t> packed_;
+  const std::uint8_t* packed_view_ = nullptr;
+  std::size_t length_ = 0;
+  MappedFile file_;
+  std::unique_ptr<SpacedSeeds> spaced_;
+  ContigTable contigs_;
+  unsigned shard_ = 0;
+  unsigned shards_ = 1;
+  bool delta_ = false;
+  std::size_t delta_base_ = 0;
+};
+
+// Calls f(std::integral_constant<int, K>()) with K == k, so f can name
+// Blast_DB<K> and everything templated on it. Throws for a k outside
+// [MIN_WORD_SIZE, MAX_WORD_SIZE].
+template <class F, int... I>
+void with_word_size(int k, F&& f, std::integer_sequence<int, I...>) {
+  bool found = ((k == MIN_WORD_SIZE + I
+                     ? (f(std::integral_constant<int, MIN_WORD_SIZE + I>()), true)
+                     : false) || ...);
+  if (!found) {
+    throw std::invalid_argument("Word size " + std::to_string(k) + " is not between " +
+                                std::to_string(MIN_WORD_SIZE) + " and " +
+                                std::to_string(MAX_WORD_SIZE));
+  }
+}
+
+template <class F>
+void with_word_size(int k, F&& f) {
+  with_word_size(k, f, std::make_integer_sequence<int, MAX_WORD_SIZE - MIN_WORD_SIZE + 1>());
+}
@@ -0,0 +1,127 @@
+// contigs.hpp : the records of a reference inside one concatenated
+// genome, and reading a reference as shards of whole records.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "seq_reader.hpp"
+
+// Name a reference gets when its records carry none, e.g. a plain
+// sequence file, and that an index without a contig table reports.
+static const char DEFAULT_CONTIG_NAME[] = "genome";
+
+// Contig i covers genome[start(i), end(i)). Starts ascend, so find() is a
+// binary search.
+class ContigTable {
+ public:
+  ContigTable() = default;
+
+  // One contig covering the whole genome.
+  static ContigTable single(std::size_t length) {
+    ContigTable t;
+    t.add(DEFAULT_CONTIG_NAME, 0);
+    t.finish(length);
+    return t;
+  }
+
+  void add(std::string_view name, std::size_t start) {
+    names_.emplace_back(name);
+    starts_.push_back(start);
+  }
+
+  void rename(std::size_t i, std::string name) { names_[i] = std::move(name); }
+
+  // Sets where the last contig ends.
+  void finish(std::size_t length) { length_ = length; }
+
+  // Adds more's contigs after the end of this table's last one.
+  void append(ContigTable const& more) {
+    for (std::size_t i = 0; i < more.size(); i++) add(more.name(i), length_ + more.start(i));
+    length_ += more.length_;
+  }
+
+  // Length of the genome the table covers.
+  std::size_t genome_length() const { return length_; }
+
+  std::size_t size() const { return starts_.size(); }
+  bool empty() const { return starts_.empty(); }
+  std::string const& name(std::size_t i) const { return names_[i]; }
+  std::size_t start(std::size_t i) const { return starts_[i]; }
+  std::size_t end(std::size_t i) const { return i + 1 < starts_.size() ? starts_[i + 1] : length_; }
+  std::size_t length(std::size_t i) const { return end(i) - start(i); }
+  std::vector<std::uint64_t> const& starts() const { return starts_; }
+
+  // The contig holding genome position pos.
+  std::size_t find(std::size_t pos) const {
+    return std::upper_bound(starts_.begin(), starts_.end(), pos) - starts_.begin() - 1;
+  }
+
+  // Contig starts after the first: the positions no seed may span.
+  std::vector<std::size_t> breaks() const {
+    return std::vector<std::size_t>(starts_.begin() + std::min<std::size_t>(1, starts_.size()),
+                                    starts_.end());
+  }
+
+  // Names joined by '\0', for an index file.
+  std::string joined_names() const {
+    std::string out;
+    for (std::string const& n : names_) out.append(n).append(1, '\0');
+    return out;
+  }
+
+  // Rebuilds a table from an index file's starts and joined_names().
+  static ContigTable from_file(const std::uint64_t* starts, std::size_t count,
+                               std::string_view names, std::size_t length) {
+    ContigTable t;
+    for (std::size_t i = 0; i < count; i++) {
+      std::size_t nul = std::min(names.find('\0'), names.size());
+      t.add(names.substr(0, nul), starts[i]);
+      names.remove_prefix(std::min(nul + 1, names.size()));
+    }
+    t.finish(length);
+    return t;
+  }
+
+ private:
+  std::vector<std::string> names_;
+  std::vector<std::uint64_t> starts_;
+  std::size_t length_ = 0;
+};
+
+// Reads a reference in shards of whole records, calling f(genome,
+// contigs) for each with at least shard_bases bases, then for the rest;
+// shard_bases == 0 makes one shard. A record with a name starts a contig;
+// unnamed records, such as lines of a plain sequence file, extend the
+// current one. A record longer than shard_bases is a shard of its own.
+// An empty file still makes one, empty, shard.
+template <class F>
+void read_shards(std::string const& path, std::size_t shard_bases, F&& f) {
+  SeqReader reader(path);
+  std::string genome;
+  ContigTable contigs;
+  if (shard_bases == 0) genome.reserve(reader.size_hint());
+  auto flush = [&] {
+    contigs.finish(genome.size());
+    f(std::move(genome), std::move(contigs));
+    genome = std::string();
+    contigs = ContigTable();
+  };
+  SeqRecord rec;
+  while (reader.next(rec)) {
+    if (!rec.name.empty() || contigs.empty()) {
+      if (shard_bases && genome.size() >= shard_bases) flush();
+      std::string_view name = record_id(rec.name);
+      contigs.add(name.empty() ? std::string_view(DEFAULT_CONTIG_NAME) : name, genome.size());
+    }
+    genome.append(rec.seq.data(), rec.seq.size());
+  }
+  if (contigs.empty()) contigs.add(DEFAULT_CONTIG_NAME, 0);
+  flush();
+}
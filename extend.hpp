@@ -0,0 +1,169 @@
+// extend.hpp : cheap filters between seeding and gapped alignment.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "UnorderedMap.hpp"
+#include "align.hpp"
+#include "blast.hpp"
+#include "kmer.hpp"
+
+// Knobs for the ungapped and gapped stages. The defaults send every seed
+// hit straight to the full gapped aligner, as before.
+struct ExtendParams {
+  int xdrop = 20;            // stop extending once this far below the best score
+  int min_ungapped = 0;      // 0 disables the ungapped stage
+  int two_hit_window = 0;    // 0 disables two-hit triggering
+  int band = 0;              // initial band half-width; 0 aligns the full matrix
+};
+
+struct UngappedHit {
+  int score;
+  std::size_t query_start, query_end;  // [start, end) in the read
+  std::size_t genome_start;
+};
+
+// Extends the exact seed read[q, q + k) == genome[g, g + k) along its
+// diagonal in both directions without gaps, scoring matches and
+// mismatches like the gapped aligner and giving up once the running score
+// falls more than xdrop below the best seen. The extension stays within
+// genome[lo, hi), the seed's contig, like the windows aligned after it.
+template <class DB>
+inline UngappedHit extend_ungapped(DB const& db, std::string const& read, std::size_t q,
+                                   std::size_t g, int k, int xdrop, std::size_t lo, std::size_t hi) {
+  int best = k * MATCH_BONUS;
+  int score = best;
+  std::size_t best_end = q + k;
+  for (std::size_t qe = q + k, ge = g + k; qe < read.size() && ge < hi; ) {
+    score += base_code(read[qe++]) == db.base(ge++) ? MATCH_BONUS : MISMATCH_PENALTY;
+    if (score > best) {
+      best = score;
+      best_end = qe;
+    } else if (best - score > xdrop) {
+      break;
+    }
+  }
+
+  score = best;
+  std::size_t best_start = q;
+  for (std::size_t qs = q, gs = g; qs > 0 && gs > lo; ) {
+    score += base_code(read[--qs]) == db.base(--gs) ? MATCH_BONUS : MISMATCH_PENALTY;
+    if (score > best) {
+      best = score;
+      best_start = qs;
+    } else if (best - score > xdrop) {
+      break;
+    }
+  }
+  return UngappedHit{ best, best_start, best_end, g - (q - best_start) };
+}
+
+// Per-diagonal values for one read, in a flat table reused from read to
+// read. Slots carry the generation of the read that filled them, so
+// reset() is O(1) and never touches the table.
+class DiagonalMap {
+ public:
+  DiagonalMap() : keys_(64), values_(64), stamps_(64, 0) { }
+
+  void reset() {
+    size_ = 0;
+    if (++stamp_ == 0) {
+      std::fill(stamps_.begin(), stamps_.end(), 0);
+      stamp_ = 1;
+    }
+  }
+
+  bool contains(kmer_t diagonal) const { return stamps_[probe(diagonal)] == stamp_; }
+
+  // The value for diagonal, 0 the first time this read asks for it.
+  std::size_t& operator[](kmer_t diagonal) {
+    if (2 * (size_ + 1) > keys_.size()) grow();
+    std::size_t s = probe(diagonal);
+    if (stamps_[s] != stamp_) {
+      keys_[s] = diagonal;
+      values_[s] = 0;
+      stamps_[s] = stamp_;
+      size_++;
+    }
+    return values_[s];
+  }
+
+ private:
+  // The slot holding diagonal, or the empty one it would go in.
+  std::size_t probe(kmer_t diagonal) const {
+    std::size_t mask = keys_.size() - 1;
+    std::size_t s = (polymer_hash()(diagonal) >> 32) & mask;
+    while (stamps_[s] == stamp_ && keys_[s] != diagonal) s = (s + 1) & mask;
+    return s;
+  }
+
+  void grow() {
+    std::vector<kmer_t> keys;
+    std::vector<std::size_t> values;
+    std::vector<std::uint32_t> stamps;
+    keys.swap(keys_);
+    values.swap(values_);
+    stamps.swap(stamps_);
+    keys_.resize(2 * keys.size());
+    values_.resize(2 * keys.size());
+    stamps_.assign(2 * keys.size(), 0);
+    for (std::size_t s = 0; s < keys.size(); s++) {
+      if (stamps[s] == stamp_) {
+        std::size_t t = probe(keys[s]);
+        keys_[t] = keys[s];
+        values_[t] = values[s];
+        stamps_[t] = stamp_;
+      }
+    }
+  }
+
+  std::vector<kmer_t> keys_;
+  std::vector<std::size_t> values_;
+  std::vector<std::uint32_t> stamps_;
+  std::uint32_t stamp_ = 1;
+  std::size_t size_ = 0;
+};
+
+// Two-hit triggering for one read at a time: a seed at read offset q on
+// diagonal d passes only if an earlier seed on d ended at or before q and
+// started no more than window bases before it.
+class TwoHitFilter {
+ public:
+  TwoHitFilter(int k, int window) : k_(k), window_(window) { }
+
+  void reset() { last_.reset(); }
+
+  // diagonal is genome position minus read offset, shifted non-negative.
+  bool hit(kmer_t diagonal, std::size_t q) {
+    std::size_t& last = last_[diagonal];  // read offset + 1, 0 if none
+    if (last != 0 && q < last - 1 + k_) {
+      return false;  // overlaps the seed we are waiting on
+    }
+    bool pass = last != 0 && q - (last - 1) <= std::size_t(window_);
+    last = q + 1;
+    return pass;
+  }
+
+ private:
+  int k_;
+  int window_;
+  DiagonalMap last_;
+};
+
+// The diagonals one read already has a hit on.
+class DiagonalSet {
+ public:
+  void reset() { map_.reset(); }
+
+  bool contains(kmer_t diagonal) const { return map_.contains(diagonal); }
+
+  void insert(kmer_t diagonal) { map_[diagonal]; }
+
+ private:
+  DiagonalMap map_;
+};
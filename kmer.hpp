@@ -0,0 +1,164 @@
+// kmer.hpp : 2-bit nucleotide packing and a rolling k-mer encoder.
+//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// A packed k-mer, 2 bits per base with the first base in the high bits.
+// 64 bits holds words of up to 32 bases.
+typedef std::uint64_t kmer_t;
+
+// A=0, C=1, G=2, T=3 (either case). Anything else, e.g. N, maps to 4.
+static constexpr unsigned INVALID_BASE = 4;
+
+constexpr std::array<unsigned char, 256> make_base_codes() {
+  std::array<unsigned char, 256> codes{};
+  for (auto& c : codes) c = INVALID_BASE;
+  codes['A'] = codes['a'] = 0;
+  codes['C'] = codes['c'] = 1;
+  codes['G'] = codes['g'] = 2;
+  codes['T'] = codes['t'] = 3;
+  return codes;
+}
+
+static constexpr std::array<unsigned char, 256> BASE_CODES = make_base_codes();
+static constexpr char CODE_BASES[4] = {'A', 'C', 'G', 'T'};
+
+inline unsigned base_code(char c) {
+  return BASE_CODES[static_cast<unsigned char>(c)];
+}
+
+constexpr kmer_t kmer_mask(int k) {
+  return k >= 32 ? ~kmer_t(0) : (kmer_t(1) << (2 * k)) - 1;
+}
+
+// Compile-time facts about k-mers of K bases. key_type is the narrowest
+// integer holding a packed K-mer: 32 bits up to k = 16, 64 bits up to 32.
+template <int K>
+struct KmerTraits {
+  static_assert(K >= 1 && K <= 32, "a k-mer holds 1 to 32 bases");
+  typedef typename std::conditional<K <= 16, std::uint32_t, std::uint64_t>::type key_type;
+  static constexpr kmer_t mask = kmer_mask(K);
+};
+
+// Reverse complement of a packed k-mer: complement every base (3 - b is
+// b ^ 3), reverse the order of the 2-bit groups, then drop the unused
+// high bits.
+inline kmer_t reverse_complement_kmer(kmer_t v, int k) {
+  v = ~v;
+  v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+  v = __builtin_bswap64(v);
+  return v >> (64 - 2 * k);
+}
+
+// The smaller of a k-mer and its reverse complement; a k-mer and its
+// reverse complement share one canonical form.
+inline kmer_t canonical_kmer(kmer_t v, int k) {
+  return std::min(v, reverse_complement_kmer(v, k));
+}
+
+inline std::string reverse_complement(std::string const& s) {
+  std::string out(s.size(), 'N');
+  for (std::size_t i = 0; i < s.size(); i++) {
+    unsigned b = base_code(s[s.size() - 1 - i]);
+    if (b != INVALID_BASE) out[i] = CODE_BASES[3 - b];
+  }
+  return out;
+}
+
+// Slides a k-base window over a sequence one base at a time. Each push is a
+// shift, an or and a mask; a base outside ACGT empties the window so no
+// k-mer ever spans it. The reverse complement of the window rolls along
+// with it, entering at the high end.
+class KmerEncoder {
+ public:
+  explicit KmerEncoder(int k) : mask_(kmer_mask(k)), rc_shift_(2 * (k - 1)), k_(k) { }
+
+  // Returns true when the window holds k valid bases ending at c.
+  bool push(char c) {
+    unsigned b = base_code(c);
+    if (b == INVALID_BASE) {
+      reset();
+      return false;
+    }
+    value_ = ((value_ << 2) | b) & mask_;
+    rc_ = (rc_ >> 2) | (kmer_t(3 - b) << rc_shift_);
+    if (len_ < k_) ++len_;
+    return len_ == k_;
+  }
+
+  kmer_t value() const { return value_; }
+  kmer_t reverse() const { return rc_; }
+  kmer_t canonical() const { return std::min(value_, rc_); }
+  // Valid bases at the end of the window, up to k; the low 2 * length()
+  // bits of value() are meaningful even before the window fills.
+  int length() const { return len_; }
+  int size() const { return k_; }
+
+  void reset() {
+    value_ = 0;
+    rc_ = 0;
+    len_ = 0;
+  }
+
+ private:
+  kmer_t mask_;
+  int rc_shift_;
+  kmer_t value_ = 0;
+  kmer_t rc_ = 0;
+  int k_;
+  int len_ = 0;
+};
+
+// Packs s[pos, pos + k). Returns false if the range is short or holds a
+// base outside ACGT.
+inline bool encode_kmer(std::string const& s, std::size_t pos, int k, kmer_t& out) {
+  if (pos + k > s.size()) return false;
+  kmer_t v = 0;
+  for (int i = 0; i < k; i++) {
+    unsigned b = base_code(s[pos + i]);
+    if (b == INVALID_BASE) return false;
+    v = (v << 2) | b;
+  }
+  out = v;
+  return true;
+}
+
+inline std::string decode_kmer(kmer_t v, int k) {
+  std::string s(k, 'A');
+  for (int i = k - 1; i >= 0; i--) {
+    s[i] = CODE_BASES[v & 3];
+    v >>= 2;
+  }
+  return s;
+}
+
+// Four bases per byte, first base in the low bits. Bases outside ACGT
+// pack as A; callers that must skip them (the seed index) read the
+// unpacked text.
+inline std::vector<std::uint8_t> pack_sequence(std::string const& s) {
+  std::vector<std::uint8_t> packed((s.size() + 3) / 4, 0);
+  for (std::size_t i = 0; i < s.size(); i++) {
+    unsigned b = base_code(s[i]);
+    if (b == INVALID_BASE) b = 0;
+    packed[i >> 2] |= static_cast<std::uint8_t>(b << ((i & 3) * 2));
+  }
+  return packed;
+}
+
+inline unsigned packed_base(const std::uint8_t* packed, std::size_t i) {
+  return (packed[i >> 2] >> ((i & 3) * 2)) & 3;
+}
+
+inline void unpack_sequence(const std::uint8_t* packed, std::size_t pos, std::size_t len, char* out) {
+  for (std::size_t i = 0; i < len; i++) {
+    out[i] = CODE_BASES[packed_base(packed, pos + i)];
+  }
+}
@@ -1,5 +1,13 @@
 #include "UnorderedMap.hpp"
+#include "align_cache.hpp"
 #include "blast.hpp"
+#include "extend.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "query.hpp"
+#include "seq_reader.hpp"
+#include "shards.hpp"
+#include "stats.hpp"
 #include <string>
 #include <algorithm>
 #include <cmath>
@@ -11,9 +19,13 @@
 #include <chrono>
 #include <iostream>
 #include <cassert>
+#include <memory>
 #include <sstream>
 #include <utility>
 #include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <stdexcept>
 using namespace std;
 
 using std::chrono::high_resolution_clock;
@@ -22,8 +34,7 @@ using std::chrono::duration;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 
-static const int WORD_SIZE = Blast_DB::WORD_SIZE;
-static const int SENTENCE_SIZE = 50;
+static const unsigned QUERY_SEED = 42;
 
 template<typename T>
 T roundFloorMultiple( T value, T multiple )
@@ -32,7 +43,7 @@ T roundFloorMultiple( T value, T multiple )
     return static_cast<T>(std::floor(static_cast<double>(value)/static_cast<double>(multiple))*static_cast<double>(multiple));
 }
 
-using Data = Blast_DB::data;
+using Data = Blast_Base::data;
 
 /*
 Go through each 50-mer string in sample_hw_dataset.txt, break those strings down into 11-mer 
@@ -41,51 +52,169 @@ we found, use seed expansion to get the full 50-mer string from the test_genome.
 these two 50-mer strings, send them to the Needleman Wunsch algorithm, and output the result.
 */
 using namespace std;
-void ProcessDataset(std::string genome, std::string file, int iterations) {
-	Blast_DB db(genome);
-	db.store_polymers();
-	auto& table = db.table();
-	std::cout << "1c " << iterations << "\n";
-	std::ifstream test(file);
-	assert(test.is_open());
-	std::vector<Data> stk;
+
+// One batch of reads on its way through the q3 pipeline. A fixed number
+// of them circulate, handed back to the reader once written, so their
+// buffers are reused and memory stays bounded however far a stage falls
+// behind.
+struct PipelineBatch {
+	std::size_t seq = 0;
+	ReadBatch reads;
+	std::vector<SeededBatch> seeded;  // one per shard of the pass
+	BatchResult result;
+};
+
+// Reads stream from the file (FASTA, FASTQ, one per line, or gzipped)
+// through four stages joined by bounded queues: one thread reads
+// READ_BATCH-sized batches, seed_threads seed them against the read-only
+// index, align_threads align and format each into its own buffer, and
+// this thread writes the buffers in input order, so the output is the
+// same for any thread counts. A stage that falls behind fills its input
+// queue and stalls the ones before it.
+// The human format keeps its banner and perfect-hit total; PAF and SAM
+// carry records only. stats, when given, collects every batch's counters
+// plus the time spent reading input and writing output, and how full
+// each queue ran.
+// Every batch is queried against every shard and the hits merged per
+// read. With in_turn the reads are instead streamed once per shard, so
+// only one shard's pages are in use at a time, and the results are held
+// until the last shard is done. Alignments are cached per shard, in
+// cache_bytes split between the shards held at once; 0 turns caching off.
+template <class Shards>
+void ProcessDataset(Shards const& shards, std::string const& file, int iterations, unsigned seed_threads, unsigned align_threads, ExtendParams const& params, OutputFormat format, bool in_turn, std::size_t cache_bytes, QueryStats* stats = NULL) {
+	OutputWriter writer;
+	if (format == FORMAT_HUMAN) std::cout << "1c " << iterations << "\n";
+	if (format == FORMAT_SAM) {
+		std::string header;
+		format_sam_header(header, shards.contig_tables());
+		writer.write(header);
+	}
 	int pHits = 0;
-	UnorderedMapPool found;
-	for (std::string str; std::getline(test, str); ) {
-		if (str[0] != '>') {
-			for (std::size_t i = 0; i < str.size(); i++) {
-				std::string word = str.substr(i, WORD_SIZE);
-				if (found[word] == 0 && word.size() == WORD_SIZE && table.find(word) != table.end()) {
-					found[word] = 1;
-					stk.push_back({ str, i, table[word] });
-					int idx = table[word] - i;
-					if (idx >= 0) {
-						std::string genome_substr = genome.substr(idx, 50);
-						std::cout << genome_substr << " " << str << '\n';
-						auto p = Blast_DB::query(genome_substr, str);
-						std::cout << "Genome location for best hit: " << idx << '\n';
-						std::cout << "Score: " << p.first << '\n';
-						if (p.first == 100) pHits++;
-						auto p2 = p.second;
-						std::cout << p2.first << '\n';
-						for (int i = 0; i < p2.first.size(); i++) {
-							if (p2.first[i] != '-' && p2.second[i] != '-') {
-								if (p2.first[i] != p2.second[i])
-									std::cout << "x";
-								else
-									std::cout << "|";
-							} else {
-								std::cout << " ";
-							}
-						}
-						std::cout << '\n';
-						std::cout << p2.second << "\n\n";
-					}
+	bool collect = stats != NULL;
+	auto emit = [&](BatchResult const& r) {
+		StageTimer timer(stats, QueryStats::WRITE);
+		writer.write(r.text);
+		pHits += r.perfect_hits;
+		if (stats) stats->merge(r.stats);
+	};
+
+	typedef std::unique_ptr<AlignmentCache> Cache;
+	typedef std::unique_ptr<PipelineBatch> Batch;
+	// One pass over the reads against the shards in pass, each with the
+	// cache at the same place in caches, calling done(result) in input
+	// order.
+	auto each_batch = [&](std::vector<std::size_t> const& pass, std::vector<Cache> const& caches, auto done) {
+		// Enough batches to keep every thread busy; the reorder buffer
+		// below holds at most as many.
+		std::size_t slots = 4 * (seed_threads + align_threads);
+		BoundedQueue<Batch> free(slots), to_seed(2 * seed_threads, seed_threads),
+			to_align(2 * align_threads, align_threads), to_write(2);
+		for (std::size_t i = 0; i < slots; i++) {
+			Batch b(new PipelineBatch);
+			free.push(b);
+		}
+		Pipeline pipeline([&] {
+			free.close();
+			to_seed.close();
+			to_align.close();
+			to_write.close();
+		});
+		QueryStats read_stats;
+
+		pipeline.stage(1, [&] {
+			SeqReader reader(file);
+			Batch b;
+			for (std::size_t seq = 0; free.pop(b); seq++) {
+				StageTimer timer(collect ? &read_stats : NULL, QueryStats::READ);
+				b->reads.clear();
+				if (!reader.next_batch(b->reads, READ_BATCH)) break;
+				timer.stop();
+				b->seq = seq;
+				if (!to_seed.push(b)) break;
+			}
+		}, [&] { to_seed.close(); });
+
+		pipeline.stage(seed_threads, [&] {
+			Batch b;
+			while (to_seed.pop(b)) {
+				b->seeded.resize(pass.size());
+				for (std::size_t i = 0; i < pass.size(); i++) {
+					b->seeded[i] = SeedBatch(shards[pass[i]], b->reads, params, collect);
+				}
+				if (!to_align.push(b)) break;
+			}
+		}, [&] { to_align.close(); });
+
+		pipeline.stage(align_threads, [&] {
+			Batch b;
+			std::vector<BatchResult> parts;
+			while (to_align.pop(b)) {
+				parts.clear();
+				for (std::size_t i = 0; i < pass.size(); i++) {
+					parts.push_back(AlignBatch(shards[pass[i]], b->reads, b->seeded[i], params, format, collect, caches[i].get()));
+				}
+				b->seeded.clear();
+				b->result = merge_shards(parts);
+				if (!to_write.push(b)) break;
+			}
+		}, [&] { to_write.close(); });
+
+		// Batches come off to_write in any order; batch seq waits in
+		// pending[seq % slots] until the ones before it are written.
+		try {
+			std::vector<Batch> pending(slots);
+			std::size_t next = 0;
+			Batch b;
+			while (to_write.pop(b)) {
+				std::size_t at = b->seq % slots;
+				pending[at] = std::move(b);
+				for (; pending[next % slots]; next++) {
+					Batch& ready = pending[next % slots];
+					done(std::move(ready->result));
+					ready->result = BatchResult();
+					free.push(ready);
+					ready.reset();
 				}
 			}
+		} catch (...) {
+			pipeline.fail(std::current_exception());
 		}
+		free.close();
+		pipeline.join();
+		if (stats) {
+			stats->merge(read_stats);
+			BoundedQueue<Batch> const* queues[QueryStats::QUEUES] = { &free, &to_seed, &to_align, &to_write };
+			for (int q = 0; q < QueryStats::QUEUES; q++) stats->queues[q].merge(queues[q]->stats());
+		}
+	};
+
+	auto make_cache = [&](std::size_t bytes) {
+		return Cache(cache_bytes ? new AlignmentCache(bytes) : NULL);
+	};
+	if (!in_turn || shards.size() == 1) {
+		std::vector<std::size_t> pass;
+		std::vector<Cache> caches;
+		for (std::size_t s = 0; s < shards.size(); s++) {
+			pass.push_back(s);
+			caches.push_back(make_cache(cache_bytes / shards.size()));
+		}
+		each_batch(pass, caches, emit);
+	} else {
+		std::vector<std::vector<BatchResult>> results;  // [batch][shard]
+		for (std::size_t s = 0; s < shards.size(); s++) {
+			std::size_t b = 0;
+			std::vector<Cache> caches;
+			caches.push_back(make_cache(cache_bytes));
+			each_batch({ s }, caches, [&](BatchResult r) {
+				if (s == 0) results.emplace_back();
+				results[b++].push_back(std::move(r));
+			});
+			shards[s].release();
+		}
+		for (std::vector<BatchResult>& parts : results) emit(merge_shards(parts));
 	}
-	std::cout << "Perfect hits: " << pHits << '\n';
+	if (format == FORMAT_HUMAN) std::cout << "Perfect hits: " << pHits << '\n';
+	writer.flush();
 }
 
 template<class T>
@@ -102,19 +231,14 @@ void print(std::vector<std::vector<T>> arr) {
   std::cout<<"]\n";
 }
 
-void runq1(int iterations, std::string genome, std::vector<Data>& stk) {
-	Blast_DB db(genome.substr(0, iterations));
-	std::cout << "Number of characters in the genome: " << genome.size() << '\n';
-	assert(genome.size());
-	auto& table = db.table();
-	std::cout << "Number of " << WORD_SIZE << " character fragments possible: " << (genome.size() - WORD_SIZE + 1) << "\n";
-
-	std::vector<int> q;
-	std::cout << "Generating random queries...\n";
+template <class DB>
+void runq1(int iterations, DB const& db, std::vector<Data>& stk) {
+	const int k = DB::WORD_SIZE;
+	std::cout << "Number of characters in the genome: " << db.size() << '\n';
+	assert(db.size());
+	std::cout << "Number of " << k << " character fragments possible: " << (db.size() - k + 1) << "\n";
 
-	std::cout << "Populating hash table...\n";
-	db.store_polymers();
-	std::cout << "Hash table populated\n";
+	std::string sentence = db.window(0, iterations);
 	std::cout << "Starting timer:\n";
 
 	std::cout << "Processing queries...\n";
@@ -122,50 +246,46 @@ void runq1(int iterations, std::string genome, std::vector<Data>& stk) {
 	auto t1 = high_resolution_clock::now();
 	
 	UnorderedMapPool found;
-	string last;
-	std::string sentence = genome.substr(0, iterations);
-	for (std::size_t i = 0; i < sentence.size(); i++) {
-		std::string word = sentence.substr(i, WORD_SIZE);
-		
-		if (word.size() != WORD_SIZE) break;
-		
-		if (found[word] == 0 && table.find(word) != table.end()) {
+	db.index().for_each_seed(sentence, [&](typename DB::key_type key, kmer_t word, std::size_t j) {
+		std::size_t i = j + 1 - k;
+
+		position_span hits = db.index().lookup(key);
+		if (found[word] == 0 && !hits.empty()) {
 			found[word] = 1;
-			stk.push_back(Data{ word, i, table[word] });
+			for (std::size_t pos : hits)
+				stk.push_back(Data{ word, i, pos });
 			count++;
 		}
-	}
+	});
 	
 	auto t2 = high_resolution_clock::now();
 	std::chrono::duration<double> ms_double = t2 - t1;
 	std::cout << "Ended timer\n";
 	std::cout << "Time taken: " << ms_double.count() << " sec\n";
 
-	std::cout << "Total 11 fragments matched: " << count << "\n";
+	std::cout << "Total " << k << " fragments matched: " << count << "\n";
 	std::cout << "Total queries used: " << iterations << "\n";
 }
 
-void runq2(int c, std::string genome, std::vector<Data>& stk) {
-	Blast_DB db(genome.substr(0, c));
-	std::cout << "Number of characters in the genome: " << genome.size() << '\n';
-	assert(genome.size());
-	auto& table = db.table();
-	std::cout << "Number of " << WORD_SIZE << " character fragments possible: " << (genome.size() - WORD_SIZE + 1) << "\n";
+// Queries are genome windows as long as the reads, drawn at read-length
+// boundaries.
+template <class DB>
+void runq2(int c, DB const& db, std::size_t read_length, std::vector<Data>& stk) {
+	const int k = DB::WORD_SIZE;
+	std::cout << "Number of characters in the genome: " << db.size() << '\n';
+	assert(db.size() && read_length);
+	std::cout << "Number of " << k << " character fragments possible: " << (db.size() - k + 1) << "\n";
 
 	std::vector<int> q;
 	std::cout << "Generating random queries...\n";
 
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::default_random_engine dre(rd());
+	// Fixed seed, so every run draws the same queries.
+	std::mt19937 gen(QUERY_SEED);
 	std::geometric_distribution<> d(0.05);
 
 	for (int i = 0; i < c; i++)
 		q.push_back(d(gen) % c);
 
-	std::cout << "Populating hash table...\n";
-	db.store_polymers();
-	std::cout << "Hash table populated\n";
 	std::cout << "Starting timer:\n";
 
 	std::cout << "Processing queries...\n";
@@ -176,68 +296,239 @@ void runq2(int c, std::string genome, std::vector<Data>& stk) {
 	
 	for (int i = 0; i < q.size(); i++) {
 		idx += q[i];
-		int newIdx = roundFloorMultiple(idx % c, 50);
-		std::string sentence = genome.substr(newIdx, 50);
-		if (sentence.size() != 50) continue;
-		for (std::size_t i = 0; i < sentence.size(); i++) {
-			std::string word = sentence.substr(i, WORD_SIZE);
-			if (word.size() == WORD_SIZE) {
-				if (found[word] == 0 && table.find(word) != table.end()) {
-					found[word] = 1;
-					stk.push_back(Data{ word, i, table[word] });
-					count++;
-				}
+		std::size_t newIdx = roundFloorMultiple<std::size_t>(idx % c, read_length);
+		std::string sentence = db.window(newIdx, read_length);
+		if (sentence.size() != read_length) continue;
+		db.index().for_each_seed(sentence, [&](typename DB::key_type key, kmer_t word, std::size_t j) {
+			std::size_t i = j + 1 - k;
+			position_span hits = db.index().lookup(key);
+			if (found[word] == 0 && !hits.empty()) {
+				found[word] = 1;
+				for (std::size_t pos : hits)
+					stk.push_back(Data{ word, i, pos });
+				count++;
 			}
-		}
+		});
 	}
 	auto t2 = high_resolution_clock::now();
 	std::chrono::duration<double> ms_double = t2 - t1;
 	std::cout << "Ended timer\n";
 	std::cout << "Time taken: " << ms_double.count() << " sec\n";
 
-	std::cout << "Total 11 fragments matched: " << count << "\n";
+	std::cout << "Total " << k << " fragments matched: " << count << "\n";
 	std::cout << "Total queries used: " << q.size() << "\n";
 	std::cout << "Perfect hits(score = 100): " << '\n';
 }
 
-void q1(int c, std::string genome, std::vector<Data>& stk) {
+template <class DB>
+void q1(int c, DB const& db, std::vector<Data>& stk) {
 	for (int i = 1; i <= 3; i++) {
 		string x(i, '0');
 		std::cout << "\n1a 1" << (x.size() == 3 ? "M" : x + "K") << std::endl;
-		runq1(10000 * pow(10, i-1), genome, stk);
+		runq1(10000 * pow(10, i-1), db, stk);
 	}
 }
 
-void q2(int c, std::string genome, std::vector<Data>& stk) {
+template <class DB>
+void q2(int c, DB const& db, std::size_t read_length, std::vector<Data>& stk) {
 	for (int i = 1; i <= 3; i++) {
 		string x(i, '0');
 		std::cout << "\n1b 1" << (x.size() == 3 ? "M" : x + "K") << std::endl;
-		runq2(10000 * pow(10,i-1), genome, stk);
+		runq2(10000 * pow(10,i-1), db, read_length, stk);
 	}
 }
 
-int main(int argc, char* argv[]) {
-	assert(argc >= 3);
-#ifdef TEST
-#else
-	std::ifstream ifs(argv[1]);
-	assert(ifs.is_open());
-#endif
-	std::string genome;
-	for (std::string str; std::getline(ifs, str); ) {
-		if (str[0] == '>') continue;
-		genome += str;
+// Command-line flags, pulled out of argv before the positional arguments
+// are read.
+struct Options {
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	ExtendParams extend;
+	OutputFormat format = FORMAT_HUMAN;
+	bool canonical = false;  // index both strands when building from FASTA
+	bool spaced = false;     // index spaced seeds instead of 11-mers (q3 only)
+	std::string stats;   // q3 stats JSON goes here at exit; "-" for stderr
+	bool perf = false;   // add hardware counters to the stats
+	int word_size = 0;   // 0: the index file's, or DEFAULT_WORD_SIZE
+	int minimizer = 1;   // minimizer window when building; 1 files every k-mer
+	std::size_t shard_size = 0;  // bases per shard when building; 0 for one shard
+	bool in_turn = false;  // query one shard at a time
+	std::size_t align_cache = 64;  // MiB of cached alignments for q3; 0 for none
+	unsigned seed_threads = 0;   // q3 seeding threads; 0 takes a share of threads
+	unsigned align_threads = 0;  // q3 alignment threads; 0 takes the rest
+};
+
+Options parse_options(int& argc, char* argv[]) {
+	Options opt;
+	int out = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			opt.threads = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--xdrop") == 0 && i + 1 < argc) {
+			opt.extend.xdrop = std::max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--min-ungapped") == 0 && i + 1 < argc) {
+			opt.extend.min_ungapped = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--two-hit") == 0 && i + 1 < argc) {
+			opt.extend.two_hit_window = std::max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--band") == 0 && i + 1 < argc) {
+			opt.extend.band = std::max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+			opt.format = parse_output_format(argv[++i]);
+		} else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+			opt.stats = argv[++i];
+		} else if (strcmp(argv[i], "--perf") == 0) {
+			opt.perf = true;
+		} else if (strcmp(argv[i], "--canonical") == 0) {
+			opt.canonical = true;
+		} else if (strcmp(argv[i], "--word-size") == 0 && i + 1 < argc) {
+			opt.word_size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--minimizer") == 0 && i + 1 < argc) {
+			opt.minimizer = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--shard-size") == 0 && i + 1 < argc) {
+			opt.shard_size = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--align-cache") == 0 && i + 1 < argc) {
+			opt.align_cache = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--seed-threads") == 0 && i + 1 < argc) {
+			opt.seed_threads = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--align-threads") == 0 && i + 1 < argc) {
+			opt.align_threads = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--shards-in-turn") == 0) {
+			opt.in_turn = true;
+		} else if (strcmp(argv[i], "--spaced") == 0) {
+			opt.spaced = true;
+		} else {
+			argv[out++] = argv[i];
+		}
 	}
-	
+	argc = out;
+	return opt;
+}
+
+// For a minimizer index, how much of the genome it files against what
+// (w,k)-minimizers keep of random sequence.
+template <int K>
+void print_density(ShardSet<K> const& shards) {
+	int w = shards[0].index().window();
+	if (w == 1) return;
+	// k-mer positions per contig, as seeds never span two.
+	std::size_t kmers = 0;
+	for (const ContigTable* contigs : shards.contig_tables()) {
+		for (std::size_t c = 0; c < contigs->size(); c++) {
+			kmers += contigs->length(c) >= std::size_t(K) ? contigs->length(c) - K + 1 : 0;
+		}
+	}
+	std::cerr << "Minimizer index (w = " << w << ", k = " << K << "): "
+	          << shards.seeds() << " of " << shards.bases() << " positions, density "
+	          << (kmers ? double(shards.seeds()) / kmers : 0.0)
+	          << " (expected " << minimizer_density(w) << ")\n";
+}
+
+// Seeding takes about a third of the time alignment and formatting do, so
+// unless set it gets a third of --threads and alignment the rest.
+unsigned seed_threads(Options const& opt) {
+	return opt.seed_threads ? opt.seed_threads : std::max(1u, opt.threads / 3);
+}
+unsigned align_threads(Options const& opt) {
+	if (opt.align_threads) return opt.align_threads;
+	return std::max(1u, opt.threads > seed_threads(opt) ? opt.threads - seed_threads(opt) : 1u);
+}
+
+ShardOptions shard_options(Options const& opt) {
+	ShardOptions s;
+	s.shard_bases = opt.shard_size;
+	s.canonical = opt.canonical;
+	s.window = opt.minimizer;
+	s.spaced = opt.spaced;
+	s.threads = opt.threads;
+	return s;
+}
+
+// Maps an index written by `main index`, every shard of it, or reads a
+// FASTA genome (plain or gzipped) and builds the seed index in memory.
+// Progress goes to stderr so PAF and SAM on stdout stay parseable.
+template <int K>
+ShardSet<K> load_database(std::string const& path, Options const& opt) {
+	if (Blast_Base::is_index_file(path)) {
+		ShardSet<K> shards = ShardSet<K>::open(path);
+		print_density(shards);
+		return shards;
+	}
+	std::cerr << "Populating hash table...\n";
+	ShardSet<K> shards = ShardSet<K>::build(path, shard_options(opt));
+	std::cerr << "Hash table populated\n";
+	print_density(shards);
+	return shards;
+}
+
+// Length of the first read in path.
+std::size_t first_read_length(std::string const& path) {
+	SeqReader reader(path);
+	SeqRecord rec;
+	return reader.next(rec) ? rec.seq.size() : 0;
+}
+
+// Everything after option parsing, for one word size.
+template <int K>
+int run(int argc, char* argv[], Options const& opt) {
+	if (strcmp(argv[1], "index") == 0) {
+		if (argc != 4) {
+			std::cout << "Usage: " << argv[0] << " index <genome.fa> <out.idx>\n";
+			return 1;
+		}
+		std::size_t bases = 0, seeds = 0;
+		std::size_t shards = ShardSet<K>::write(argv[2], argv[3], shard_options(opt), [&](Blast_DB<K> const& db) {
+			bases += db.size();
+			seeds += db.index().size();
+		});
+		std::cout << "Wrote " << argv[3] << ": " << bases << " bases, " << seeds << " seeds";
+		if (shards > 1) std::cout << " in " << shards << " shards";
+		std::cout << '\n';
+		return 0;
+	}
+	if (strcmp(argv[1], "append") == 0) {
+		if (argc != 4) {
+			std::cout << "Usage: " << argv[0] << " append <genome.idx> <more.fa>\n";
+			return 1;
+		}
+		std::size_t bases = ShardSet<K>::append_file(argv[2], argv[3], opt.threads);
+		std::cout << "Wrote " << ShardSet<K>::delta_path(argv[2]) << ": " << bases
+		          << " bases pending compaction\n";
+		return 0;
+	}
+	if (strcmp(argv[1], "compact") == 0) {
+		if (argc != 3) {
+			std::cout << "Usage: " << argv[0] << " compact <genome.idx>\n";
+			return 1;
+		}
+		if (ShardSet<K>::compact_file(argv[2])) std::cout << "Compacted " << argv[2] << '\n';
+		else std::cout << argv[2] << " has no delta segment\n";
+		return 0;
+	}
+
 	std::vector<Data> stk;
 	if (argc == 4) {
 		if (strcmp(argv[3], "q1") == 0) {
-			q1(1, genome, stk);
+			q1(1, load_database<K>(argv[1], opt)[0], stk);
 		}
 		else if (strcmp(argv[3], "q2") == 0) {
-			q2(1, genome, stk);
+			q2(1, load_database<K>(argv[1], opt)[0], first_read_length(argv[2]), stk);
 		} else if (strcmp(argv[3], "q3") == 0) {
-			ProcessDataset(genome, argv[2], 1000);
+			ShardSet<K> db = load_database<K>(argv[1], opt);
+			QueryStats stats;
+			PerfCounters perf;
+			if (opt.perf) perf.start();
+			auto t1 = high_resolution_clock::now();
+			ProcessDataset(db, argv[2], 1000, seed_threads(opt), align_threads(opt), opt.extend, opt.format, opt.in_turn, opt.align_cache << 20, opt.stats.empty() ? NULL : &stats);
+			std::chrono::duration<double> wall = high_resolution_clock::now() - t1;
+			if (opt.perf) perf.stop();
+			if (!opt.stats.empty()) {
+				std::ofstream file;
+				if (opt.stats != "-") file.open(opt.stats);
+				if (opt.stats != "-" && !file) {
+					std::cerr << "Could not create " << opt.stats << '\n';
+					return 1;
+				}
+				write_stats_json(opt.stats == "-" ? std::cerr : file, stats, wall.count(), opt.perf ? &perf : NULL);
+			}
 			//ProcessDataset(genome, argv[2], 10000);
 			//ProcessDataset(genome, argv[2], 100000);
 		} else if (strcmp(argv[3], "q4") == 0) {
@@ -247,7 +538,7 @@ int main(int argc, char* argv[]) {
 			std::string s1 = "AGCGTATCGCATGCATTCGCGCATAAGCTAG",
 						s2 = "TCTCTGGAGCGGGCTTCGTATATGCTAAAGC";
 
-			auto p = Blast_DB::query(s1, s2, &s, &t);
+			auto p = Blast_Base::query(s1, s2, &s, &t);
 			std::cout << "Score: " << p.first << '\n';
 			
 			auto p2 = p.second;
@@ -273,4 +564,28 @@ int main(int argc, char* argv[]) {
 	} else {
 		std::cout << "Invalid number of arguments.\n";
 	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	Options opt = parse_options(argc, argv);
+	assert(argc >= 3);
+	// An index file fixes its word size; otherwise --word-size or the default.
+	bool command = strcmp(argv[1], "index") == 0 || strcmp(argv[1], "append") == 0 ||
+	               strcmp(argv[1], "compact") == 0;
+	std::string genome = command ? argv[2] : argv[1];
+	int status = 1;
+	// A mismatched or unreadable index, or a word size out of range, ends
+	// the run with its message rather than an abort.
+	try {
+		int k = opt.word_size;
+		if (k == 0) {
+			k = Blast_Base::is_index_file(genome) ? Blast_Base::index_word_size(genome) : DEFAULT_WORD_SIZE;
+		}
+		with_word_size(k, [&](auto w) { status = run<decltype(w)::value>(argc, argv, opt); });
+	} catch (std::exception const& e) {
+		std::cerr << e.what() << '\n';
+		return 1;
+	}
+	return status;
 }
@@ -0,0 +1,77 @@
+// mapped_file.hpp : read-only mmap of a whole file.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  explicit MappedFile(std::string const& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Could not stat " + path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ > 0) {
+      void* p = ::mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Could not map " + path);
+      }
+      data_ = static_cast<const char*>(p);
+    }
+    // The mapping keeps the file alive on its own.
+    ::close(fd);
+  }
+
+  MappedFile(MappedFile&& other) noexcept
+      : data_(other.data_), size_(other.size_) {
+    other.data_ = NULL;
+    other.size_ = 0;
+  }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+
+  ~MappedFile() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Hint the kernel about the access pattern of [offset, offset + len).
+  void advise(std::size_t offset, std::size_t len, int advice) const {
+    if (!data_ || offset >= size_) return;
+    long page = ::sysconf(_SC_PAGESIZE);
+    std::size_t start = offset / page * page;
+    ::madvise(const_cast<char*>(data_) + start, std::min(size_, offset + len) - start, advice);
+  }
+
+ private:
+  const char* data_ = NULL;
+  std::size_t size_ = 0;
+};
@@ -0,0 +1,97 @@
+// minimizer.hpp : (w,k)-minimizer sampling of a stream of k-mers.
+//
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "kmer.hpp"
+
+// An invertible mix of the low 2k bits of key (mask = kmer_mask(k)), so
+// minimizers are spread over the k-mer space instead of favouring runs
+// of A, which plain k-mer order would.
+inline kmer_t minimizer_hash(kmer_t key, kmer_t mask) {
+  key = (~key + (key << 21)) & mask;
+  key = key ^ key >> 24;
+  key = (key + (key << 3) + (key << 8)) & mask;
+  key = key ^ key >> 14;
+  key = (key + (key << 2) + (key << 4)) & mask;
+  key = key ^ key >> 28;
+  key = (key + (key << 31)) & mask;
+  return key;
+}
+
+// Picks the k-mer of smallest hash, the leftmost on ties, out of every w
+// consecutive k-mers of a run, and reports each pick once. Picks only
+// move right as the window slides, so they come out in position order.
+// Runs shorter than w k-mers pick nothing. Both index and reads are
+// sampled with this, so a read shares a window's pick with the genome
+// whenever it covers the whole window.
+class MinimizerSampler {
+ public:
+  // key is what the index files the k-mer under, word the k-mer as read,
+  // end the position of its last base.
+  struct Pick {
+    kmer_t key;
+    kmer_t word;
+    std::size_t end;
+  };
+
+  MinimizerSampler(int k, int w) : mask_(kmer_mask(k)), ring_(w) { }
+
+  // Ends the run, e.g. at a base outside ACGT.
+  void reset() {
+    filled_ = 0;
+    head_ = 0;
+    has_last_ = false;
+  }
+
+  // Adds the next k-mer of the run. Returns true and sets out when the
+  // window's pick is new.
+  bool push(kmer_t key, kmer_t word, std::size_t end, Pick& out) {
+    std::size_t w = ring_.size();
+    Entry e{ minimizer_hash(key, mask_), Pick{ key, word, end } };
+    bool evicted = filled_ >= w && min_ == head_;
+    ring_[head_] = e;
+    std::size_t slot = head_;
+    head_ = head_ + 1 == w ? 0 : head_ + 1;
+    if (filled_ < w) filled_++;
+
+    if (filled_ == 1 || evicted) {
+      // Rescan oldest to newest, so the leftmost of equal hashes wins.
+      min_ = filled_ < w ? 0 : head_;
+      for (std::size_t n = 1, s = min_; n < filled_; n++) {
+        s = s + 1 == w ? 0 : s + 1;
+        if (ring_[s].hash < ring_[min_].hash) min_ = s;
+      }
+    } else if (e.hash < ring_[min_].hash) {
+      min_ = slot;
+    }
+
+    if (filled_ < w) return false;
+    Pick const& pick = ring_[min_].pick;
+    if (has_last_ && pick.end == last_end_) return false;
+    has_last_ = true;
+    last_end_ = pick.end;
+    out = pick;
+    return true;
+  }
+
+ private:
+  struct Entry {
+    kmer_t hash;
+    Pick pick;
+  };
+
+  kmer_t mask_;
+  std::vector<Entry> ring_;  // the last w k-mers; head_ is the oldest once full
+  std::size_t filled_ = 0;
+  std::size_t head_ = 0;
+  std::size_t min_ = 0;
+  bool has_last_ = false;
+  std::size_t last_end_ = 0;
+};
+
+// Expected fraction of k-mers a (w,k)-minimizer index keeps, for random
+// sequence.
+inline double minimizer_density(int w) { return w <= 1 ? 1.0 : 2.0 / (w + 1); }
@@ -0,0 +1,209 @@
+// output.hpp : formatting of alignment hits into large text buffers.
+//
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "blast.hpp"
+#include "contigs.hpp"
+
+enum OutputFormat { FORMAT_HUMAN, FORMAT_PAF, FORMAT_SAM };
+
+inline OutputFormat parse_output_format(std::string const& name) {
+  if (name == "human") return FORMAT_HUMAN;
+  if (name == "paf") return FORMAT_PAF;
+  if (name == "sam") return FORMAT_SAM;
+  throw std::invalid_argument("Unknown output format " + name);
+}
+
+// One gapped alignment of a read against the window starting genome_pos
+// bases into a contig; aln.seq1 is the window and aln.seq2 the read. For
+// a reverse-strand hit, read is the reverse complement that was aligned.
+struct HitRecord {
+  std::string_view read_name;
+  std::string_view read;
+  std::string_view window;
+  std::string_view contig;
+  std::size_t contig_length;
+  std::size_t genome_pos;
+  bool reverse;
+  Blast_Base::alignment const& aln;
+};
+
+inline void append_number(std::string& out, long long v) {
+  char buf[24];
+  out.append(buf, std::to_chars(buf, buf + sizeof buf, v).ptr);
+}
+
+// The view q3 has always printed: both sequences, location, score and the
+// gapped pair with a match bar between them. The location is prefixed by
+// its contig unless the reference had no record names.
+inline void format_human(std::string& out, HitRecord const& h) {
+  std::string const& a = h.aln.seq1;
+  std::string const& b = h.aln.seq2;
+  out.append(h.window).append(1, ' ').append(h.read).append(1, '\n');
+  out.append("Genome location for best hit: ");
+  if (h.contig != DEFAULT_CONTIG_NAME) out.append(h.contig).append(1, ':');
+  append_number(out, static_cast<long long>(h.genome_pos));
+  if (h.reverse) out.append(" (reverse strand)");
+  out.append("\nScore: ");
+  append_number(out, h.aln.score);
+  out.append(1, '\n').append(a).append(1, '\n');
+  std::size_t bar = out.size();
+  out.append(a.size(), ' ');
+  for (std::size_t i = 0; i < a.size(); i++) {
+    if (a[i] != '-' && b[i] != '-') out[bar + i] = a[i] == b[i] ? '|' : 'x';
+  }
+  out.append(1, '\n').append(b).append("\n\n");
+}
+
+// Appends the CIGAR of columns [first, last) of a gapped pair to cigar,
+// with a, the genome, as the reference, and returns how many of those
+// columns differ.
+inline long long append_cigar(std::string& cigar, std::string const& a, std::string const& b,
+                              std::size_t first, std::size_t last) {
+  long long edits = 0;
+  char op = 0;
+  long long run = 0;
+  for (std::size_t i = first; i <= last; i++) {
+    char next = 0;
+    if (i < last) {
+      next = a[i] == '-' ? 'I' : b[i] == '-' ? 'D' : 'M';
+      if (a[i] != b[i]) edits++;
+    }
+    if (next == op) {
+      run++;
+      continue;
+    }
+    if (run) {
+      append_number(cigar, run);
+      cigar += op;
+    }
+    op = next;
+    run = 1;
+  }
+  return edits;
+}
+
+// PAF: query = read, target = contig, then AS (score), NM (edit distance)
+// and cg (CIGAR with the genome as the reference). Both intervals and the
+// CIGAR run from the first to the last column pairing two bases, leaving
+// out the gaps a global alignment has before and after them. Query
+// coordinates are on the read as given, also for reverse-strand hits.
+inline void format_paf(std::string& out, HitRecord const& h) {
+  std::string const& a = h.aln.seq1;
+  std::string const& b = h.aln.seq2;
+  std::size_t first = 0, last = a.size();
+  while (first < last && (a[first] == '-' || b[first] == '-')) first++;
+  while (last > first && (a[last - 1] == '-' || b[last - 1] == '-')) last--;
+  std::size_t query_start = 0, query_end = 0, target_start = 0, target_end = 0;
+  long long matches = 0;
+  for (std::size_t i = 0; i < last; i++) {
+    if (i == first) {
+      query_start = query_end;
+      target_start = target_end;
+    }
+    if (b[i] != '-') query_end++;
+    if (a[i] != '-') target_end++;
+    if (i >= first && a[i] == b[i]) matches++;
+  }
+  if (h.reverse) {
+    std::size_t start = h.read.size() - query_end;
+    query_end = h.read.size() - query_start;
+    query_start = start;
+  }
+  std::string cigar;
+  long long edits = append_cigar(cigar, a, b, first, last);
+
+  out.append(h.read_name).append(1, '\t');
+  append_number(out, static_cast<long long>(h.read.size()));
+  out.append(1, '\t');
+  append_number(out, static_cast<long long>(query_start));
+  out.append(1, '\t');
+  append_number(out, static_cast<long long>(query_end));
+  out.append(h.reverse ? "\t-\t" : "\t+\t").append(h.contig).append(1, '\t');
+  append_number(out, static_cast<long long>(h.contig_length));
+  out.append(1, '\t');
+  append_number(out, static_cast<long long>(h.genome_pos + target_start));
+  out.append(1, '\t');
+  append_number(out, static_cast<long long>(h.genome_pos + target_end));
+  out.append(1, '\t');
+  append_number(out, matches);
+  out.append(1, '\t');
+  append_number(out, static_cast<long long>(last - first));
+  out.append("\t255\tAS:i:");
+  append_number(out, h.aln.score);
+  out.append("\tNM:i:");
+  append_number(out, edits);
+  out.append("\tcg:Z:").append(cigar.empty() ? "*" : cigar).append(1, '\n');
+}
+
+// One @SQ line per contig, shard by shard.
+inline void format_sam_header(std::string& out, std::vector<const ContigTable*> const& shards) {
+  out.append("@HD\tVN:1.6\tSO:unsorted\n");
+  for (const ContigTable* contigs : shards) {
+    for (std::size_t c = 0; c < contigs->size(); c++) {
+      out.append("@SQ\tSN:").append(contigs->name(c)).append("\tLN:");
+      append_number(out, static_cast<long long>(contigs->length(c)));
+      out.append(1, '\n');
+    }
+  }
+  out.append("@PG\tID:main\tPN:main\n");
+}
+
+// SAM: genome bases the global alignment puts before the first or after
+// the last read base are trimmed, moving POS, so the CIGAR starts and ends
+// on read bases. Reverse-strand hits get flag 16 and the reverse
+// complement as SEQ, as SAM expects.
+inline void format_sam(std::string& out, HitRecord const& h) {
+  std::string const& a = h.aln.seq1;
+  std::string const& b = h.aln.seq2;
+  std::size_t first = 0, last = b.size();
+  while (first < last && b[first] == '-') first++;
+  while (last > first && b[last - 1] == '-') last--;
+
+  std::string cigar;
+  long long edits = append_cigar(cigar, a, b, first, last);
+
+  out.append(h.read_name).append(h.reverse ? "\t16\t" : "\t0\t");
+  out.append(h.contig).append(1, '\t');
+  append_number(out, static_cast<long long>(h.genome_pos + first + 1));
+  out.append("\t255\t").append(cigar.empty() ? "*" : cigar).append("\t*\t0\t0\t");
+  out.append(h.read).append("\t*\tAS:i:");
+  append_number(out, h.aln.score);
+  out.append("\tNM:i:");
+  append_number(out, edits);
+  out.append(1, '\n');
+}
+
+inline void format_hit(std::string& out, OutputFormat format, HitRecord const& h) {
+  switch (format) {
+    case FORMAT_HUMAN: format_human(out, h); break;
+    case FORMAT_PAF: format_paf(out, h); break;
+    case FORMAT_SAM: format_sam(out, h); break;
+  }
+}
+
+// Writes whole buffers with one fwrite each. std::cout stays synced with
+// stdio, so lines printed through it interleave in order.
+class OutputWriter {
+ public:
+  explicit OutputWriter(std::FILE* out = stdout) : out_(out) { }
+
+  void write(std::string const& text) {
+    if (!text.empty() && std::fwrite(text.data(), 1, text.size(), out_) != text.size()) {
+      throw std::runtime_error("Could not write output");
+    }
+  }
+
+  void flush() { std::fflush(out_); }
+
+ private:
+  std::FILE* out_;
+};
@@ -0,0 +1,252 @@
+// pipeline.hpp : bounded lock-free queues and the threads of the stages
+// they connect.
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stats.hpp"
+
+// A bounded multi-producer, multi-consumer ring of at least capacity
+// items (rounded up to a power of two). Each cell carries a sequence
+// number saying whose turn it is, so try_push and try_pop claim a cell
+// with one compare-and-swap and never lock. push and pop spin briefly on
+// a full or empty ring, then sleep until the other side moves. Once
+// close() is called push fails and pop drains what is left.
+//
+// Every push samples the depth, and time spent blocked is added up on
+// each side, into the counters stats() reports.
+template <class T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(std::size_t capacity, unsigned consumers = 1) {
+    std::size_t n = 2;
+    while (n < capacity) n *= 2;
+    cells_.reset(new Cell[n]);
+    mask_ = n - 1;
+    for (std::size_t i = 0; i < n; i++) cells_[i].seq.store(i, std::memory_order_relaxed);
+    consumers_ = consumers;
+  }
+
+  BoundedQueue(BoundedQueue const&) = delete;
+  BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  // Moves value in unless the ring is full.
+  bool try_push(T& value) {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      std::size_t seq = cell->seq.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    sample(pos + 1);
+    return true;
+  }
+
+  // Moves the oldest item out unless the ring is empty.
+  bool try_pop(T& value) {
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      std::size_t seq = cell->seq.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->value);
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Waits for room; false, with value untouched, once the queue is closed.
+  bool push(T& value) {
+    if (try_push(value)) {
+      wake(not_empty_);
+      return true;
+    }
+    bool pushed = false;
+    wait(not_full_, full_ns_, [&] {
+      return closed_.load(std::memory_order_acquire) || (pushed = try_push(value));
+    });
+    if (pushed) wake(not_empty_);
+    return pushed;
+  }
+
+  // Waits for an item; false once the queue is closed and empty.
+  bool pop(T& value) {
+    if (try_pop(value)) {
+      wake(not_full_);
+      return true;
+    }
+    bool popped = false;
+    wait(not_empty_, empty_ns_, [&] {
+      if ((popped = try_pop(value))) return true;
+      // Everything pushed before close() is visible once closed_ is.
+      return closed_.load(std::memory_order_acquire) && !(popped = try_pop(value));
+    });
+    if (popped) wake(not_full_);
+    return popped;
+  }
+
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(lock_);
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  QueueStats stats() const {
+    QueueStats s;
+    s.capacity = capacity();
+    s.consumers = consumers_;
+    s.pushes = pushes_.load(std::memory_order_relaxed);
+    s.depth_sum = depth_sum_.load(std::memory_order_relaxed);
+    s.max_depth = max_depth_.load(std::memory_order_relaxed);
+    s.full_ns = full_ns_.load(std::memory_order_relaxed);
+    s.empty_ns = empty_ns_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+ private:
+  static const int SPINS = 64;
+
+  struct Cell {
+    std::atomic<std::size_t> seq;
+    T value;
+  };
+
+  // Items in the ring just after the push that made tail end.
+  void sample(std::size_t tail) {
+    std::size_t head = head_.load(std::memory_order_relaxed);
+    std::uint64_t depth = tail > head ? tail - head : 0;
+    pushes_.fetch_add(1, std::memory_order_relaxed);
+    depth_sum_.fetch_add(depth, std::memory_order_relaxed);
+    std::uint64_t max = max_depth_.load(std::memory_order_relaxed);
+    while (depth > max && !max_depth_.compare_exchange_weak(max, depth, std::memory_order_relaxed)) { }
+  }
+
+  // Spins, then sleeps on cv, until ready() holds, adding the time to ns.
+  // A sleeper counts itself in sleepers_ before its last look at the ring
+  // and the other side reads sleepers_ after its move, both by
+  // read-modify-write, so whichever comes second sees the other.
+  template <class Ready>
+  void wait(std::condition_variable& cv, std::atomic<std::uint64_t>& ns, Ready ready) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool done = false;
+    for (int i = 0; i < SPINS && !done; i++) {
+      std::this_thread::yield();
+      done = ready();
+    }
+    if (!done) {
+      std::unique_lock<std::mutex> lock(lock_);
+      sleepers_.fetch_add(1, std::memory_order_acq_rel);
+      cv.wait(lock, ready);
+      sleepers_.fetch_sub(1);
+    }
+    ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start).count(),
+                 std::memory_order_relaxed);
+  }
+
+  void wake(std::condition_variable& cv) {
+    if (sleepers_.fetch_add(0, std::memory_order_acq_rel) == 0) return;
+    std::lock_guard<std::mutex> lock(lock_);
+    cv.notify_all();
+  }
+
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_;
+  unsigned consumers_;
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  alignas(64) std::atomic<std::size_t> head_{0};
+  alignas(64) std::atomic<bool> closed_{false};
+  std::atomic<int> sleepers_{0};
+  std::mutex lock_;
+  std::condition_variable not_full_, not_empty_;
+  std::atomic<std::uint64_t> pushes_{0}, depth_sum_{0}, max_depth_{0}, full_ns_{0}, empty_ns_{0};
+};
+
+// The threads of a pipeline. stage() starts a stage's threads; once the
+// last of them returns, its done() runs, typically closing the stage's
+// output queue. The first exception any stage throws is kept and abort()
+// runs, which should close every queue so all stages wind down; join()
+// then rethrows it.
+class Pipeline {
+ public:
+  explicit Pipeline(std::function<void()> abort) : abort_(std::move(abort)) { }
+
+  ~Pipeline() {
+    for (std::thread& t : threads_) {
+      if (t.joinable()) t.join();
+    }
+  }
+
+  Pipeline(Pipeline const&) = delete;
+  Pipeline& operator=(Pipeline const&) = delete;
+
+  template <class Body, class Done>
+  void stage(unsigned threads, Body body, Done done) {
+    std::shared_ptr<std::atomic<unsigned>> running = std::make_shared<std::atomic<unsigned>>(threads);
+    for (unsigned t = 0; t < threads; t++) {
+      threads_.emplace_back([this, body, done, running] {
+        try {
+          body();
+        } catch (...) {
+          fail(std::current_exception());
+        }
+        if (running->fetch_sub(1) == 1) done();
+      });
+    }
+  }
+
+  // For a stage running on the calling thread.
+  void fail(std::exception_ptr error) {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      if (error_) return;
+      error_ = error;
+    }
+    abort_();
+  }
+
+  void join() {
+    for (std::thread& t : threads_) t.join();
+    threads_.clear();
+    if (error_) std::rethrow_exception(error_);
+  }
+
+ private:
+  std::function<void()> abort_;
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  std::exception_ptr error_;
+};
@@ -0,0 +1,115 @@
+// presence.hpp : a small bit filter answering whether a k-mer is indexed
+// at all, tested before the seed table is touched.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "kmer.hpp"
+
+// Up to this many bases a key gets a bit of its own: 4^k bits, 512 KB for
+// k = 11, and no false positives.
+static const int PRESENCE_EXACT_BASES = 12;
+
+// For longer keys, a blocked Bloom filter: all PROBES bits of a key fall
+// in one 64-byte block, so a test reads a single cache line. Blocks are
+// rounded up to a power of two, leaving BITS_PER_KEY to twice that per
+// filed key; under 0.5% of absent keys get through.
+class PresenceFilter {
+ public:
+  // Clears the filter for keys of k bases, sized for up to keys of them.
+  void reset(int k, std::size_t keys) {
+    exact_ = k <= PRESENCE_EXACT_BASES;
+    std::size_t blocks = 1;
+    if (exact_) {
+      blocks = std::max<std::size_t>(1, (std::size_t(1) << (2 * k)) / BLOCK_BITS);
+    } else {
+      while (blocks * BLOCK_BITS < keys * BITS_PER_KEY) blocks *= 2;
+    }
+    blocks_.assign(blocks, Block());
+    view_ = blocks_.data();
+    count_ = blocks;
+    block_mask_ = blocks - 1;
+  }
+
+  // Serves tests from bits stored elsewhere, e.g. a mapped index file,
+  // in place; data must be 64-byte aligned. False, leaving the filter
+  // unset, unless bytes is what reset(k, keys) would have allocated.
+  bool attach(int k, std::size_t keys, const void* data, std::size_t bytes) {
+    reset(k, keys);
+    if (!data || bytes != memory_bytes()) {
+      clear();
+      return false;
+    }
+    std::vector<Block>().swap(blocks_);
+    view_ = static_cast<const Block*>(data);
+    return true;
+  }
+
+  void clear() {
+    std::vector<Block>().swap(blocks_);
+    view_ = nullptr;
+    count_ = 0;
+    block_mask_ = 0;
+  }
+
+  void insert(kmer_t key) {
+    if (exact_) {
+      set(blocks_[key / BLOCK_BITS], key % BLOCK_BITS);
+      return;
+    }
+    std::uint64_t h = mix(key);
+    Block& b = blocks_[(h >> 32) & block_mask_];
+    std::uint64_t probes = mix(h);
+    for (int p = 0; p < PROBES; p++, probes >>= 9) set(b, probes & (BLOCK_BITS - 1));
+  }
+
+  // False only for keys never inserted; an unset filter holds nothing.
+  bool may_contain(kmer_t key) const {
+    if (!view_) return false;
+    if (exact_) return test(view_[key / BLOCK_BITS], key % BLOCK_BITS);
+    std::uint64_t h = mix(key);
+    Block const& b = view_[(h >> 32) & block_mask_];
+    std::uint64_t probes = mix(h);
+    for (int p = 0; p < PROBES; p++, probes >>= 9) {
+      if (!test(b, probes & (BLOCK_BITS - 1))) return false;
+    }
+    return true;
+  }
+
+  bool exact() const { return exact_; }
+  std::size_t memory_bytes() const { return count_ * sizeof(Block); }
+  // The filter bits, memory_bytes() of them, to store and attach later.
+  const void* data() const { return view_; }
+
+ private:
+  static const std::size_t BLOCK_BITS = 512;
+  static const std::size_t BITS_PER_KEY = 12;
+  static const int PROBES = 6;
+
+  struct alignas(64) Block {
+    std::uint64_t words[BLOCK_BITS / 64] = {};
+  };
+
+  static void set(Block& b, std::size_t bit) { b.words[bit / 64] |= std::uint64_t(1) << (bit % 64); }
+  static bool test(Block const& b, std::size_t bit) { return (b.words[bit / 64] >> (bit % 64)) & 1; }
+
+  // splitmix64's finalizer.
+  static std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+
+  std::vector<Block> blocks_;
+  // blocks_ or attached storage; moving blocks_ keeps its buffer.
+  const Block* view_ = nullptr;
+  std::size_t count_ = 0;
+  std::size_t block_mask_ = 0;
+  bool exact_ = true;
+};
@@ -0,0 +1,327 @@
+// query.hpp : seeding, filtering and alignment of one batch of reads.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "UnorderedMap.hpp"
+#include "align_cache.hpp"
+#include "blast.hpp"
+#include "contigs.hpp"
+#include "extend.hpp"
+#include "kmer.hpp"
+#include "output.hpp"
+#include "seq_reader.hpp"
+#include "stats.hpp"
+
+// Reads per task handed to the query pool.
+static const std::size_t READ_BATCH = 256;
+
+struct BatchResult {
+  std::string text;
+  // Where each read's hits end in text; read r's are
+  // text[read_ends[r - 1], read_ends[r]).
+  std::vector<std::size_t> read_ends;
+  int perfect_hits = 0;
+  QueryStats stats;  // filled only when asked for
+  std::vector<std::size_t> read_hits;  // hits per read, with stats
+};
+
+// One seed hit of a batch: the read, where its window starts in the
+// genome, the window's contig and bases, and the strand.
+struct SeedHit {
+  std::size_t read;
+  std::size_t idx;
+  std::size_t contig;
+  std::string window;
+  bool reverse;
+};
+
+// What seeding a batch leaves for the aligner: the hits, read by read, the
+// reverse complements they use, and the first copy of each read.
+struct SeededBatch {
+  std::vector<SeedHit> hits;
+  std::vector<std::string> reversed;
+  std::vector<std::size_t> source;
+  QueryStats stats;  // filled only when asked for
+  std::vector<std::size_t> read_hits;  // hits per read, with stats
+};
+
+// Seeds one batch of reads. A read gets one hit per distinct diagonal its
+// seeds land on, whatever other reads found, so the output of a read
+// depends only on the read itself. Each hit covers as many genome bases
+// as the read has, starting where its seed diagonal meets the read's first
+// base; windows stay inside the seed's contig. A read repeating an earlier
+// read of the batch takes its hits instead of being seeded. With
+// collect_stats the seeding timer and counters go to the result's stats.
+template <int K>
+SeededBatch SeedBatch(Blast_DB<K> const& db, ReadBatch const& batch, ExtendParams const& params,
+                      bool collect_stats = false) {
+  static const int k = K;
+  SeededBatch result;
+  QueryStats* stats = collect_stats ? &result.stats : NULL;
+  std::vector<std::string> const& reads = batch.seqs;
+  // Reverse complements of the reads, made on a read's first reverse-strand
+  // hit; only a canonical index produces those.
+  std::vector<std::string>& reversed = result.reversed;
+  reversed.resize(db.canonical() ? reads.size() : 0);
+  ContigTable const& contigs = db.contigs();
+  std::vector<SeedHit>& hits = result.hits;
+  DiagonalSet diagonals;
+  SpacedSeeds const* spaced = db.spaced();
+  TwoHitFilter two_hit(spaced ? SpacedSeeds::max_span : k, params.two_hit_window);
+
+  // Runs one seed position through the filters; the seed covers span bases
+  // from read offset i and genome position pos, exactly for a contiguous
+  // seed, only on its pattern's 1s for a spaced one.
+  auto add_hit = [&](std::size_t r, std::size_t i, std::size_t pos, int span, bool reverse) {
+    std::string const& str = reads[r];
+    // On the reverse strand the seed sits at offset q of the
+    // reverse-complemented read, and the genome runs backwards along the
+    // read, so pos + i is what stays fixed on a diagonal.
+    std::size_t q = reverse ? str.size() - i - span : i;
+    // Like the genome's start before, the start of the seed's contig
+    // drops windows that would begin before it.
+    std::size_t c = contigs.find(pos);
+    if (pos < contigs.start(c) + q) return;
+    std::size_t idx = pos - q;
+    // Seeds of a read on one diagonal share a window; the first to pass
+    // the filters makes the hit.
+    kmer_t window_key = kmer_t(idx) << 1 | reverse;
+    if (diagonals.contains(window_key)) return;
+    kmer_t diagonal = reverse ? (pos + i) | (kmer_t(1) << 63) : pos + str.size() - i;
+    if (params.two_hit_window > 0 && !two_hit.hit(diagonal, i)) {
+      if (stats) stats->two_hit_dropped++;
+      return;
+    }
+    if (reverse && reversed[r].empty()) reversed[r] = reverse_complement(str);
+    std::string const& seq = reverse ? reversed[r] : str;
+    // A spaced seed may hold mismatches, so its extension starts from an
+    // empty seed and scores every base of the span.
+    if (params.min_ungapped > 0 &&
+        extend_ungapped(db, seq, q, pos, spaced ? 0 : span, params.xdrop,
+                        contigs.start(c), contigs.end(c)).score < params.min_ungapped) {
+      if (stats) stats->ungapped_dropped++;
+      return;
+    }
+    diagonals.insert(window_key);
+    hits.push_back({ r, idx, c, db.window(idx, std::min(str.size(), contigs.end(c) - idx)), reverse });
+  };
+  auto count_lookup = [&](bool present, position_span const& seeds) {
+    if (stats) {
+      stats->seeds_looked_up++;
+      if (!present) stats->prefilter_rejected++;
+      if (!seeds.empty()) {
+        stats->seeds_hit++;
+        stats->seed_positions += seeds.size();
+      }
+    }
+  };
+
+  // source[r] is the first read of the batch equal to read r.
+  std::unordered_map<std::string_view, std::size_t> first_copy;
+  std::vector<std::size_t>& source = result.source;
+  source.resize(reads.size());
+  std::vector<std::size_t> first_hit(reads.size() + 1);
+  StageTimer seed_timer(stats, QueryStats::SEED);
+  for (std::size_t r = 0; r < reads.size(); r++) {
+    std::string const& str = reads[r];
+    std::size_t read_first_hit = first_hit[r] = hits.size();
+    two_hit.reset();
+    diagonals.reset();
+    source[r] = first_copy.emplace(str, r).first->second;
+    if (source[r] != r) {
+      std::size_t s = source[r];
+      for (std::size_t h = first_hit[s]; h < first_hit[s + 1]; h++) {
+        SeedHit copy = hits[h];
+        copy.read = r;
+        hits.push_back(std::move(copy));
+      }
+      if (!reversed.empty()) reversed[r] = reversed[s];
+      if (stats) stats->duplicate_reads++;
+    } else if (spaced) {
+      spaced->for_each_seed(str, [&](int p, std::size_t i, kmer_t key) {
+        bool present = spaced->may_contain(p, key);
+        position_span seeds = present ? spaced->probe(p, key) : position_span();
+        count_lookup(present, seeds);
+        for (std::size_t pos : seeds) add_hit(r, i, pos, SpacedSeeds::max_span, false);
+      });
+    } else {
+      // Every k-mer of the read, or its minimizers for a sampled index.
+      db.index().for_each_seed(str, [&](typename Blast_DB<K>::key_type key, kmer_t word,
+                                        std::size_t j) {
+        std::size_t i = j + 1 - k;
+        bool present = db.index().may_contain(key);
+        position_span seeds = present ? db.index().probe(key) : position_span();
+        count_lookup(present, seeds);
+        for (std::size_t pos : seeds) add_hit(r, i, pos, k, db.reverse_strand(word, pos));
+      });
+    }
+    first_hit[r + 1] = hits.size();
+    if (stats) {
+      stats->add_read_hits(hits.size() - read_first_hit);
+      result.read_hits.push_back(hits.size() - read_first_hit);
+    }
+  }
+  seed_timer.stop();
+  return result;
+}
+
+// Aligns and formats the hits SeedBatch found for batch into one buffer
+// for the writer, taking over its stats. Hits are aligned together, one
+// per SIMD lane; a hit is perfect when every base matches. Each distinct
+// (read, window) pair of the batch is aligned once, and looked up in
+// cache first when one is given; cache must belong to db.
+template <int K>
+BatchResult AlignBatch(Blast_DB<K> const& db, ReadBatch const& batch, SeededBatch& seeded,
+                       ExtendParams const& params, OutputFormat format,
+                       bool collect_stats = false, AlignmentCache* cache = NULL) {
+  BatchResult result;
+  result.stats = seeded.stats;
+  result.read_hits = std::move(seeded.read_hits);
+  QueryStats* stats = collect_stats ? &result.stats : NULL;
+  std::vector<std::string> const& reads = batch.seqs;
+  std::vector<std::string> const& reversed = seeded.reversed;
+  std::vector<std::size_t> const& source = seeded.source;
+  std::vector<SeedHit> const& hits = seeded.hits;
+  ContigTable const& contigs = db.contigs();
+
+  // Each hit aligns its window against the read on the hit's strand. The
+  // banded aligner is centred on diagonal 0, the seed's.
+  auto read_of = [&](SeedHit const& h) -> std::string const& {
+    return h.reverse ? reversed[h.read] : reads[h.read];
+  };
+  StageTimer align_timer(stats, QueryStats::ALIGN);
+  // Copies of a read share their windows; the first hit of each distinct
+  // (read, window) stands for the rest. Positions fit in 32 bits.
+  std::vector<std::size_t> pair_of(hits.size());
+  std::vector<std::size_t> pair_hits;  // first hit of each distinct pair
+  UnorderedMapPool pair_index;
+  for (std::size_t h = 0; h < hits.size(); h++) {
+    std::size_t& p = pair_index[kmer_t(source[hits[h].read]) << 33 | kmer_t(hits[h].idx) << 1 | hits[h].reverse];
+    if (p == 0) {
+      pair_hits.push_back(h);
+      p = pair_hits.size();
+    }
+    pair_of[h] = p - 1;
+  }
+
+  std::vector<Blast_Base::alignment> alignments(pair_hits.size());
+  std::vector<AlignmentKey> keys(cache ? pair_hits.size() : 0);
+  std::vector<std::uint64_t> read_hashes(cache ? reads.size() : 0);
+  std::vector<std::size_t> todo;  // pairs the aligner has to run on
+  for (std::size_t p = 0; p < pair_hits.size(); p++) {
+    SeedHit const& h = hits[pair_hits[p]];
+    if (cache) {
+      std::string const& seq = read_of(h);
+      // Hashed on first use; the low bit set keeps 0 free to mean unset.
+      if (read_hashes[h.read] == 0) read_hashes[h.read] = hash_read(reads[h.read]) | 1;
+      keys[p] = AlignmentKey{ read_hashes[h.read], h.idx, static_cast<std::uint32_t>(seq.size()),
+                              static_cast<std::uint32_t>(h.window.size() << 1 | h.reverse) };
+      if (stats) stats->cache_lookups++;
+      Blast_Base::alignment& a = alignments[p];
+      if (cache->find(keys[p], reads[h.read], a.score, a.cigar)) {
+        expand_cigar(a.cigar, h.window, seq, a.seq1, a.seq2);
+        if (stats) stats->cache_hits++;
+        continue;
+      }
+    }
+    todo.push_back(p);
+  }
+  if (params.band > 0) {
+    for (std::size_t p : todo) {
+      SeedHit const& h = hits[pair_hits[p]];
+      alignments[p] = Blast_Base::align_banded(h.window, read_of(h), 0, params.band);
+    }
+  } else {
+    std::vector<SeqPair> pairs;
+    pairs.reserve(todo.size());
+    for (std::size_t p : todo) {
+      SeedHit const& h = hits[pair_hits[p]];
+      pairs.push_back({ &h.window, &read_of(h) });
+    }
+    std::vector<Blast_Base::alignment> aligned = Blast_Base::align_batch(pairs);
+    for (std::size_t t = 0; t < todo.size(); t++) alignments[todo[t]] = std::move(aligned[t]);
+  }
+  if (cache) {
+    for (std::size_t p : todo) {
+      cache->insert(keys[p], reads[hits[pair_hits[p]].read], alignments[p].score, alignments[p].cigar);
+    }
+  }
+  if (stats) stats->aligned += todo.size();
+  align_timer.stop();
+
+  StageTimer format_timer(stats, QueryStats::FORMAT);
+  result.text.reserve(hits.size() * 256);
+  result.read_ends.assign(reads.size(), 0);
+  for (std::size_t h = 0; h < hits.size(); h++) {
+    Blast_Base::alignment const& p = alignments[pair_of[h]];
+    SeedHit const& hit = hits[h];
+    if (p.score == MATCH_BONUS * static_cast<int>(read_of(hit).size())) result.perfect_hits++;
+    HitRecord rec{ batch.names[hit.read], read_of(hit), hit.window, contigs.name(hit.contig),
+                   contigs.length(hit.contig), hit.idx - contigs.start(hit.contig), hit.reverse, p };
+    format_hit(result.text, format, rec);
+    result.read_ends[hit.read] = result.text.size();
+  }
+  for (std::size_t r = 1; r < reads.size(); r++) {
+    result.read_ends[r] = std::max(result.read_ends[r], result.read_ends[r - 1]);
+  }
+  format_timer.stop();
+  if (stats) {
+    stats->reads += reads.size();
+    stats->alignments += hits.size();
+    stats->perfect_hits += result.perfect_hits;
+  }
+  return result;
+}
+
+// Seeds and aligns one batch of reads; see SeedBatch and AlignBatch.
+template <int K>
+BatchResult ProcessBatch(Blast_DB<K> const& db, ReadBatch const& batch,
+                         ExtendParams const& params, OutputFormat format,
+                         bool collect_stats = false, AlignmentCache* cache = NULL) {
+  SeededBatch seeded = SeedBatch(db, batch, params, collect_stats);
+  return AlignBatch(db, batch, seeded, params, format, collect_stats, cache);
+}
+
+// Joins the results of one batch against each shard of a reference,
+// read by read: a read's hits in shard 0, then in shard 1, and so on.
+// parts holds at least one result.
+inline BatchResult merge_shards(std::vector<BatchResult>& parts) {
+  if (parts.size() == 1) return std::move(parts[0]);
+  BatchResult merged;
+  std::size_t reads = parts[0].read_ends.size();
+  std::size_t bytes = 0;
+  for (BatchResult const& part : parts) {
+    bytes += part.text.size();
+    merged.perfect_hits += part.perfect_hits;
+    merged.stats.merge(part.stats);
+  }
+  // Every shard saw the same reads; a read's hits add up across shards.
+  merged.stats.reads = parts[0].stats.reads;
+  merged.stats.duplicate_reads = parts[0].stats.duplicate_reads;
+  if (!parts[0].read_hits.empty()) {
+    std::fill(merged.stats.hits_per_read, merged.stats.hits_per_read + HIT_BUCKETS, 0);
+    merged.read_hits.assign(reads, 0);
+    for (BatchResult const& part : parts) {
+      for (std::size_t r = 0; r < reads; r++) merged.read_hits[r] += part.read_hits[r];
+    }
+    for (std::size_t hits : merged.read_hits) merged.stats.add_read_hits(hits);
+  }
+  merged.text.reserve(bytes);
+  merged.read_ends.resize(reads);
+  for (std::size_t r = 0; r < reads; r++) {
+    for (BatchResult const& part : parts) {
+      std::size_t first = r ? part.read_ends[r - 1] : 0;
+      merged.text.append(part.text, first, part.read_ends[r] - first);
+    }
+    merged.read_ends[r] = merged.text.size();
+  }
+  return merged;
+}
@@ -0,0 +1,400 @@
+// seed_index.hpp : every genome position of every k-mer, in CSR form.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "kmer.hpp"
+#include "minimizer.hpp"
+#include "presence.hpp"
+
+// A contiguous, ascending run of genome positions for one k-mer.
+struct position_span {
+  const std::uint32_t* first = nullptr;
+  const std::uint32_t* last = nullptr;
+
+  const std::uint32_t* begin() const { return first; }
+  const std::uint32_t* end() const { return last; }
+  std::size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+  std::uint32_t operator[](std::size_t i) const { return first[i]; }
+};
+
+// Bases of a k-mer that index offsets_ directly. 4^12 + 1 offsets take
+// 64 MB; longer k-mers would need a table of 4^k.
+static const int SEED_DIRECT_BASES = 12;
+
+// offsets_ is indexed directly by the packed k-mer (4^k + 1 entries) and
+// positions_[offsets_[w], offsets_[w + 1]) lists where w starts, in
+// genome order. Lookups are two loads; there are no per-entry objects.
+// For k > SEED_DIRECT_BASES, offsets_ is indexed by the first
+// SEED_DIRECT_BASES bases only, and suffixes_ holds the rest of each
+// window's k-mer alongside positions_, sorted within each bucket, so a
+// lookup adds a binary search over one bucket.
+// A canonical index files every window under canonical_kmer, so one table
+// answers for both strands; key() maps a query k-mer the same way.
+// With window w > 1 only the (w,k)-minimizers of the genome are filed
+// (see MinimizerSampler), about 2 / (w + 1) of its k-mers; for_each_seed
+// samples a read the same way.
+// A PresenceFilter over the filed keys, built with the table, turns away
+// most absent k-mers before offsets_ is read.
+template <int K>
+class SeedIndex {
+ public:
+  typedef std::uint32_t position_type;
+  typedef typename KmerTraits<K>::key_type key_type;
+  static constexpr int PREFIX = K < SEED_DIRECT_BASES ? K : SEED_DIRECT_BASES;
+  static constexpr int SUFFIX = K - PREFIX;
+
+  explicit SeedIndex(bool canonical = false, int window = 1)
+      : canonical_(canonical), window_(std::max(1, window)) { }
+  SeedIndex(SeedIndex&&) = default;
+  SeedIndex& operator=(SeedIndex&&) = default;
+  SeedIndex(SeedIndex const&) = delete;
+  SeedIndex& operator=(SeedIndex const&) = delete;
+
+  // Counts every k-mer, prefix-sums the counts into offsets and scatters
+  // the window starts. Windows containing a base outside ACGT are skipped.
+  // With threads > 1 the genome is split into one chunk per thread; the
+  // result is identical to the single-threaded build. No window spans a
+  // position in breaks (ascending), e.g. the start of a contig.
+  void build(std::string const& genome, unsigned threads = 1,
+             std::vector<std::size_t> const& breaks = std::vector<std::size_t>()) {
+    if (genome.size() > UINT32_MAX) {
+      throw std::length_error("Genome too large for 32-bit seed positions");
+    }
+    threads = std::max(1u, std::min<unsigned>(threads, genome.size() / (1 << 16) + 1));
+    if (threads > 1) {
+      build_parallel(genome, threads, breaks);
+    } else {
+      offsets_.assign(slots() + 1, 0);
+      for_each_window(genome, 0, genome.size(), breaks,
+                      [&](key_type w, kmer_t, std::size_t) { ++offsets_[bucket(w) + 1]; });
+      for (std::size_t w = 1; w < offsets_.size(); w++) {
+        offsets_[w] += offsets_[w - 1];
+      }
+
+      // offsets_[w] doubles as the write cursor for w; afterwards it has
+      // advanced to the old offsets_[w + 1], so shift everything back by one.
+      resize_entries(offsets_.back());
+      for_each_window(genome, 0, genome.size(), breaks, [&](key_type w, kmer_t, std::size_t i) {
+        put(offsets_[bucket(w)]++, w, i);
+      });
+      for (std::size_t w = offsets_.size() - 1; w > 0; w--) {
+        offsets_[w] = offsets_[w - 1];
+      }
+      offsets_[0] = 0;
+    }
+    sort_buckets(threads);
+    offsets_view_ = offsets_.data();
+    positions_view_ = positions_.data();
+    suffixes_view_ = suffixes_.data();
+    count_ = positions_.size();
+    build_presence();
+  }
+
+  // Takes over arrays built elsewhere, laid out as build() would.
+  void assign(std::vector<position_type> offsets, std::vector<position_type> positions,
+              std::vector<key_type> suffixes = std::vector<key_type>()) {
+    offsets_ = std::move(offsets);
+    positions_ = std::move(positions);
+    suffixes_ = std::move(suffixes);
+    offsets_view_ = offsets_.data();
+    positions_view_ = positions_.data();
+    suffixes_view_ = suffixes_.data();
+    count_ = positions_.size();
+    build_presence();
+  }
+
+  // The index of a's genome followed by b's, where b's starts at shift:
+  // each key's positions are a's, then b's moved up by shift, so the
+  // tables are merged without reading either genome. b must begin on a
+  // break, as a new contig does, and both must file the same way. The
+  // caller keeps shift plus b's genome within 32-bit positions.
+  static SeedIndex concat(SeedIndex const& a, SeedIndex const& b, std::size_t shift) {
+    if (a.canonical_ != b.canonical_ || a.window_ != b.window_) {
+      throw std::invalid_argument("Seed indexes differ in strands or minimizer window");
+    }
+    std::vector<position_type> offsets(slots() + 1, 0);
+    std::vector<position_type> positions(a.count_ + b.count_);
+    std::vector<key_type> suffixes(SUFFIX > 0 ? positions.size() : 0);
+    std::size_t out = 0;
+    for (std::size_t w = 0; w < slots(); w++) {
+      offsets[w] = static_cast<position_type>(out);
+      std::size_t i = a.offsets_view_[w], i_end = a.offsets_view_[w + 1];
+      std::size_t j = b.offsets_view_[w], j_end = b.offsets_view_[w + 1];
+      // Within a bucket, by suffix and then position; a's come first on
+      // equal suffixes, being lower.
+      while (i < i_end || j < j_end) {
+        bool take_a = j == j_end;
+        if constexpr (SUFFIX > 0) {
+          if (i < i_end && j < j_end) take_a = a.suffixes_view_[i] <= b.suffixes_view_[j];
+          suffixes[out] = take_a ? a.suffixes_view_[i] : b.suffixes_view_[j];
+        } else {
+          take_a = take_a || i < i_end;
+        }
+        positions[out++] = take_a ? a.positions_view_[i++]
+                                  : static_cast<position_type>(b.positions_view_[j++] + shift);
+      }
+    }
+    offsets[slots()] = static_cast<position_type>(out);
+    SeedIndex index(a.canonical_, a.window_);
+    index.assign(std::move(offsets), std::move(positions), std::move(suffixes));
+    return index;
+  }
+
+  // Uses arrays owned elsewhere, e.g. a mapped index file, in place.
+  // offsets must hold slots() + 1 entries, and suffixes count entries
+  // when SUFFIX > 0. presence, if given, holds presence_bytes of filter
+  // bits saved from presence(); without them, or if they do not fit this
+  // table, the filter is rebuilt from the table.
+  void attach(const position_type* offsets, const position_type* positions, std::size_t count,
+              const key_type* suffixes = nullptr, const void* presence = nullptr,
+              std::size_t presence_bytes = 0) {
+    offsets_.clear();
+    positions_.clear();
+    suffixes_.clear();
+    offsets_view_ = offsets;
+    positions_view_ = positions;
+    suffixes_view_ = suffixes;
+    count_ = count;
+    if (!presence_.attach(K, count_, presence, presence_bytes)) build_presence();
+  }
+
+  position_span lookup(key_type key) const {
+    return may_contain(key) ? probe(key) : position_span();
+  }
+
+  // False means key has no positions; true means it may have some.
+  bool may_contain(key_type key) const { return presence_.may_contain(key); }
+
+  // lookup() without the presence test, for callers that made it already.
+  position_span probe(key_type key) const {
+    if (!offsets_view_) return position_span();
+    std::size_t b = bucket(key);
+    std::size_t first = offsets_view_[b], last = offsets_view_[b + 1];
+    if constexpr (SUFFIX > 0) {
+      auto range = std::equal_range(suffixes_view_ + first, suffixes_view_ + last, suffix(key));
+      first = range.first - suffixes_view_;
+      last = range.second - suffixes_view_;
+    }
+    return position_span{ positions_view_ + first, positions_view_ + last };
+  }
+
+  bool contains(key_type key) const { return !lookup(key).empty(); }
+
+  const position_type* offsets() const { return offsets_view_; }
+  const position_type* positions() const { return positions_view_; }
+  // NULL unless SUFFIX > 0.
+  const key_type* suffixes() const { return suffixes_view_; }
+
+  // The table slot for a k-mer read off a query.
+  key_type key(kmer_t word) const {
+    return static_cast<key_type>(canonical_ ? canonical_kmer(word, K) : word);
+  }
+  key_type key(KmerEncoder const& word) const {
+    return static_cast<key_type>(canonical_ ? word.canonical() : word.value());
+  }
+
+  // Calls f(key, word, j) for every k-mer of s the index would file,
+  // ending at s[j]: word is the k-mer as read and key its table slot.
+  template <class F>
+  void for_each_seed(std::string const& s, F&& f) const {
+    static const std::vector<std::size_t> no_breaks;
+    for_each_window(s, 0, s.size(), no_breaks, f);
+  }
+
+  bool canonical() const { return canonical_; }
+  // Minimizer window; 1 files every k-mer.
+  int window() const { return window_; }
+  static constexpr int word_size() { return K; }
+  static constexpr std::size_t slots() { return std::size_t(1) << (2 * PREFIX); }
+  // Total number of indexed positions.
+  std::size_t size() const { return count_; }
+  std::size_t memory_bytes() const {
+    return (slots() + 1 + count_) * sizeof(position_type) +
+           (SUFFIX > 0 ? count_ * sizeof(key_type) : 0) + presence_.memory_bytes();
+  }
+  PresenceFilter const& presence() const { return presence_; }
+
+ private:
+  static std::size_t bucket(key_type key) { return key >> (2 * SUFFIX); }
+  static key_type suffix(key_type key) { return key & static_cast<key_type>(kmer_mask(SUFFIX)); }
+
+  void resize_entries(std::size_t total) {
+    positions_.assign(total, 0);
+    if constexpr (SUFFIX > 0) suffixes_.assign(total, 0);
+  }
+
+  // Files the window of key w ending at genome[i] in entry slot.
+  void put(std::size_t slot, key_type w, std::size_t i) {
+    positions_[slot] = static_cast<position_type>(i + 1 - K);
+    if constexpr (SUFFIX > 0) suffixes_[slot] = suffix(w);
+  }
+
+  // Orders each bucket by suffix. Entries arrive in genome order, so
+  // sorting (suffix, position) pairs keeps each k-mer's positions ascending.
+  void sort_buckets(unsigned threads) {
+    if constexpr (SUFFIX > 0) {
+      run_threads(threads, [&](unsigned r) {
+        std::vector<std::pair<key_type, position_type>> entries;
+        for (std::size_t b = slots() * r / threads; b < slots() * (r + 1) / threads; b++) {
+          std::size_t first = offsets_[b], last = offsets_[b + 1];
+          if (last - first < 2) continue;
+          entries.clear();
+          for (std::size_t e = first; e < last; e++) entries.emplace_back(suffixes_[e], positions_[e]);
+          std::sort(entries.begin(), entries.end());
+          for (std::size_t e = first; e < last; e++) {
+            suffixes_[e] = entries[e - first].first;
+            positions_[e] = entries[e - first].second;
+          }
+        }
+      });
+    }
+  }
+
+  // Sets every key with positions: each non-empty slot while k-mers index
+  // offsets_ directly, else each distinct suffix within a bucket. Index
+  // files store the result, so only files older than that pay this pass
+  // when opened.
+  void build_presence() {
+    presence_.reset(K, count_);
+    for (std::size_t b = 0; b < slots(); b++) {
+      std::size_t first = offsets_view_[b], last = offsets_view_[b + 1];
+      if constexpr (SUFFIX > 0) {
+        for (std::size_t e = first; e < last; e++) {
+          if (e == first || suffixes_view_[e] != suffixes_view_[e - 1]) {
+            presence_.insert(key_type(b) << (2 * SUFFIX) | suffixes_view_[e]);
+          }
+        }
+      } else if (first != last) {
+        presence_.insert(b);
+      }
+    }
+  }
+
+  template <class F>
+  static void run_threads(unsigned n, F const& f) {
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < n; t++) pool.emplace_back(f, t);
+    f(0);
+    for (auto& th : pool) th.join();
+  }
+
+  // Calls f(key, word, j) for every filed window ending at genome[j],
+  // lo <= j < hi, priming the encoder with the k - 1 bases before lo.
+  // Minimizers also prime the w - 1 k-mers before lo and run w - 1 bases
+  // past hi, since the windows that pick j span that far; a chunk reports
+  // only the picks inside it, so chunks never repeat or lose one. Each
+  // break empties the window as a base outside ACGT would.
+  template <class F>
+  void for_each_window(std::string const& genome, std::size_t lo, std::size_t hi,
+                       std::vector<std::size_t> const& breaks, F&& f) const {
+    KmerEncoder word(K);
+    std::size_t back = (K - 1) + (window_ - 1);
+    std::size_t i = lo >= back ? lo - back : 0;
+    auto next_break = std::lower_bound(breaks.begin(), breaks.end(), i);
+    std::size_t stop = next_break == breaks.end() ? SIZE_MAX : *next_break;
+    auto at_break = [&] {
+      if (i != stop) return false;
+      stop = ++next_break == breaks.end() ? SIZE_MAX : *next_break;
+      word.reset();
+      return true;
+    };
+    if (window_ == 1) {
+      for (; i < lo; i++) {
+        at_break();
+        word.push(genome[i]);
+      }
+      for (; i < hi; i++) {
+        at_break();
+        if (word.push(genome[i])) f(key(word), word.value(), i);
+      }
+      return;
+    }
+    MinimizerSampler sampler(K, window_);
+    MinimizerSampler::Pick pick;
+    std::size_t end = std::min(genome.size(), hi + window_ - 1);
+    for (; i < end; i++) {
+      if (at_break()) sampler.reset();
+      if (!word.push(genome[i])) {
+        sampler.reset();
+      } else if (sampler.push(key(word), word.value(), i, pick) && pick.end >= lo && pick.end < hi) {
+        f(static_cast<key_type>(pick.key), pick.word, pick.end);
+      }
+    }
+  }
+
+  // Each thread counts its chunk into a private table. Per key, thread t
+  // writes after the hits of threads 0..t-1, so positions stay ascending
+  // and no two threads ever share a cursor.
+  void build_parallel(std::string const& genome, unsigned threads,
+                      std::vector<std::size_t> const& breaks) {
+    std::size_t n = genome.size();
+    std::size_t keys = slots();
+    auto chunk = [&](unsigned t) { return n * t / threads; };
+    std::vector<std::vector<position_type>> counts(threads);
+
+    run_threads(threads, [&](unsigned t) {
+      std::vector<position_type>& c = counts[t];
+      c.assign(keys, 0);
+      for_each_window(genome, chunk(t), chunk(t + 1), breaks,
+                      [&](key_type w, kmer_t, std::size_t) { ++c[bucket(w)]; });
+    });
+
+    // Prefix-sum in key order, split into key ranges. First the size of
+    // each range, then each range turns its counts into write cursors.
+    auto range = [&](unsigned r) { return keys * r / threads; };
+    std::vector<std::size_t> range_base(threads + 1, 0);
+    run_threads(threads, [&](unsigned r) {
+      std::size_t sum = 0;
+      for (std::size_t w = range(r); w < range(r + 1); w++) {
+        for (unsigned t = 0; t < threads; t++) sum += counts[t][w];
+      }
+      range_base[r + 1] = sum;
+    });
+    for (unsigned r = 0; r < threads; r++) range_base[r + 1] += range_base[r];
+
+    offsets_.assign(keys + 1, 0);
+    offsets_[keys] = static_cast<position_type>(range_base[threads]);
+    run_threads(threads, [&](unsigned r) {
+      std::size_t next = range_base[r];
+      for (std::size_t w = range(r); w < range(r + 1); w++) {
+        offsets_[w] = static_cast<position_type>(next);
+        for (unsigned t = 0; t < threads; t++) {
+          position_type c = counts[t][w];
+          counts[t][w] = static_cast<position_type>(next);
+          next += c;
+        }
+      }
+    });
+
+    resize_entries(range_base[threads]);
+    run_threads(threads, [&](unsigned t) {
+      std::vector<position_type>& cursor = counts[t];
+      for_each_window(genome, chunk(t), chunk(t + 1), breaks, [&](key_type w, kmer_t, std::size_t i) {
+        put(cursor[bucket(w)]++, w, i);
+      });
+    });
+  }
+
+  bool canonical_;
+  int window_;
+  std::vector<position_type> offsets_;
+  std::vector<position_type> positions_;
+  std::vector<key_type> suffixes_;
+  // Either the vectors above or attached external storage. Moving the
+  // vectors keeps their buffers, so a moved index stays valid.
+  const position_type* offsets_view_ = nullptr;
+  const position_type* positions_view_ = nullptr;
+  const key_type* suffixes_view_ = nullptr;
+  std::size_t count_ = 0;
+  PresenceFilter presence_;
+};
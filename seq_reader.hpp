@@ -0,0 +1,291 @@
+// seq_reader.hpp : streaming FASTA / FASTQ / plain-line reader over a
+// mapped file or a gzip stream.
+//
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "mapped_file.hpp"
+
+// One record. name has the leading '>' or '@' stripped; qual is empty
+// outside FASTQ. The views stay valid until the next call to next().
+struct SeqRecord {
+  std::string_view name;
+  std::string_view seq;
+  std::string_view qual;
+};
+
+// A record's ID: its name up to the first space or tab. What follows is
+// a free-form description and never goes into output columns.
+inline std::string_view record_id(std::string_view name) {
+  return name.substr(0, name.find_first_of(" \t"));
+}
+
+// Inflates a gzip file on a background thread into fixed-size blocks,
+// keeping at most a few of them queued ahead of the reader.
+class GzipStream {
+ public:
+  static const std::size_t BLOCK_SIZE = 1 << 20;
+  static const std::size_t MAX_QUEUED = 4;
+
+  explicit GzipStream(std::string const& path) : file_(gzopen(path.c_str(), "rb")) {
+    if (!file_) {
+      throw std::runtime_error("Could not open " + path);
+    }
+    gzbuffer(file_, 1 << 18);
+    worker_ = std::thread([this, path] { run(path); });
+  }
+
+  ~GzipStream() {
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+    gzclose(file_);
+  }
+
+  GzipStream(GzipStream const&) = delete;
+  GzipStream& operator=(GzipStream const&) = delete;
+
+  // Appends the next block to out; false once the stream is exhausted.
+  bool read(std::string& out) {
+    std::unique_lock<std::mutex> lock(m_);
+    cv_.wait(lock, [this] { return !blocks_.empty() || done_; });
+    if (!error_.empty()) {
+      throw std::runtime_error(error_);
+    }
+    if (blocks_.empty()) return false;
+    out += blocks_.front();
+    blocks_.pop_front();
+    lock.unlock();
+    cv_.notify_all();
+    return true;
+  }
+
+ private:
+  void run(std::string const& path) {
+    for (;;) {
+      std::string block(BLOCK_SIZE, '\0');
+      int got = gzread(file_, &block[0], static_cast<unsigned>(block.size()));
+      std::unique_lock<std::mutex> lock(m_);
+      if (got < 0) {
+        int code;
+        error_ = path + ": " + gzerror(file_, &code);
+      }
+      if (got <= 0) {
+        done_ = true;
+        break;
+      }
+      block.resize(got);
+      cv_.wait(lock, [this] { return stop_ || blocks_.size() < MAX_QUEUED; });
+      if (stop_) break;
+      blocks_.push_back(std::move(block));
+      lock.unlock();
+      cv_.notify_all();
+    }
+    cv_.notify_all();
+  }
+
+  gzFile file_;
+  std::thread worker_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<std::string> blocks_;
+  std::string error_;
+  bool done_ = false;
+  bool stop_ = false;
+};
+
+// Owned copies of a run of records, e.g. to hand to another thread.
+// names holds record IDs; records without a name get their 1-based
+// number in the file.
+struct ReadBatch {
+  std::vector<std::string> names;
+  std::vector<std::string> seqs;
+
+  std::size_t size() const { return seqs.size(); }
+  bool empty() const { return seqs.empty(); }
+  void clear() {
+    names.clear();
+    seqs.clear();
+  }
+};
+
+// Reads records one at a time. Plain files are mapped and single-line
+// records come back as views straight into the mapping; multi-line
+// records are joined into a buffer owned by the reader. Files starting
+// with the gzip magic are inflated by a GzipStream and always copied.
+// A record starts with '>' (FASTA) or '@' (FASTQ); any other non-empty
+// line is a record of its own, with no name.
+class SeqReader {
+ public:
+  explicit SeqReader(std::string const& path) : path_(path) {
+    MappedFile file(path);
+    if (file.size() >= 2 && static_cast<unsigned char>(file.data()[0]) == 0x1f &&
+        static_cast<unsigned char>(file.data()[1]) == 0x8b) {
+      // ISIZE: the uncompressed length mod 2^32, from the gzip trailer.
+      if (file.size() >= 18) {
+        std::uint32_t isize;
+        std::memcpy(&isize, file.data() + file.size() - 4, sizeof isize);
+        size_hint_ = isize;
+      }
+      gzip_.reset(new GzipStream(path));
+    } else {
+      file.advise(0, file.size(), MADV_SEQUENTIAL);
+      data_ = file.data();
+      end_ = file.size();
+      size_hint_ = file.size();
+      file_ = std::move(file);
+    }
+  }
+
+  // Roughly how many bytes of text the file holds; an upper bound on the
+  // total sequence length, except for gzip files over 4 GB.
+  std::size_t size_hint() const { return size_hint_; }
+
+  bool next(SeqRecord& rec) {
+    std::string_view line;
+    do {
+      if (!next_line(line)) return false;
+    } while (line.empty());
+
+    rec = SeqRecord();
+    records_++;
+    if (line[0] != '>' && line[0] != '@') {
+      rec.seq = keep(line, seq_);
+      return true;
+    }
+    bool fastq = line[0] == '@';
+    rec.name = keep(line.substr(1), name_);
+
+    // Sequence lines run up to the next header, or the '+' line in FASTQ.
+    rec.seq = read_lines(fastq ? "+" : ">", seq_);
+    if (!fastq) return true;
+    if (!next_line(line) || line.empty() || line[0] != '+') {
+      throw std::runtime_error(path_ + ": malformed FASTQ record " + std::string(rec.name));
+    }
+    // Quality lines can start with '@', so they end on length instead.
+    qual_.clear();
+    while (qual_.size() < rec.seq.size() && next_line(line)) qual_.append(line);
+    if (qual_.size() != rec.seq.size()) {
+      throw std::runtime_error(path_ + ": quality length mismatch in " + std::string(rec.name));
+    }
+    rec.qual = qual_;
+    return true;
+  }
+
+  // Appends up to max records to out and returns how many were added.
+  std::size_t next_batch(ReadBatch& out, std::size_t max) {
+    std::size_t added = 0;
+    SeqRecord rec;
+    while (added < max && next(rec)) {
+      std::string_view id = record_id(rec.name);
+      if (id.empty()) out.names.push_back(std::to_string(records_));
+      else out.names.emplace_back(id);
+      out.seqs.emplace_back(rec.seq);
+      added++;
+    }
+    return added;
+  }
+
+ private:
+  // A view of v that outlives the next read: v itself when it points into
+  // the mapping, otherwise a copy in store.
+  std::string_view keep(std::string_view v, std::string& store) {
+    if (!gzip_) return v;
+    store.assign(v.data(), v.size());
+    return store;
+  }
+
+  // Joins lines up to (not including) one starting with a character in
+  // stop, or the end of input. A single line stays a view when it can.
+  std::string_view read_lines(const char* stop, std::string& store) {
+    std::string_view line;
+    int c = peek();
+    if (c < 0 || std::strchr(stop, c)) return std::string_view();
+    next_line(line);
+    std::string_view first = keep(line, store);
+    c = peek();
+    if (c < 0 || std::strchr(stop, c)) return first;
+    if (!gzip_) store.assign(first.data(), first.size());
+    while ((c = peek()) >= 0 && !std::strchr(stop, c)) {
+      next_line(line);
+      store.append(line.data(), line.size());
+    }
+    return store;
+  }
+
+  // First byte of the next line, or -1 at the end of input.
+  int peek() {
+    if (pos_ == end_ && !refill()) return -1;
+    return static_cast<unsigned char>(data_[pos_]);
+  }
+
+  // Next line without its "\n" or "\r\n"; false at the end of input.
+  bool next_line(std::string_view& line) {
+    if (pos_ == end_ && !refill()) return false;
+    std::size_t scanned = pos_;
+    const void* nl;
+    while (!(nl = std::memchr(data_ + scanned, '\n', end_ - scanned))) {
+      scanned = end_;
+      std::size_t offset = pos_;
+      if (!refill()) break;
+      scanned -= offset - pos_;
+    }
+    std::size_t stop = nl ? static_cast<const char*>(nl) - data_ : end_;
+    line = std::string_view(data_ + pos_, stop - pos_);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    pos_ = nl ? stop + 1 : end_;
+    return true;
+  }
+
+  // Gzip only: drops the consumed prefix of buf_ and appends a block.
+  bool refill() {
+    if (!gzip_) return false;
+    buf_.erase(0, pos_);
+    pos_ = 0;
+    bool more = gzip_->read(buf_);
+    data_ = buf_.data();
+    end_ = buf_.size();
+    return more;
+  }
+
+  std::string path_;
+  MappedFile file_;
+  std::unique_ptr<GzipStream> gzip_;
+  std::string buf_;
+  // Unread input is data_[pos_, end_): the mapping, or buf_ for gzip.
+  const char* data_ = NULL;
+  std::size_t pos_ = 0;
+  std::size_t end_ = 0;
+  std::size_t size_hint_ = 0;
+  std::size_t records_ = 0;
+  std::string name_, seq_, qual_;
+};
+
+// Concatenates the sequences of every record in path, reserving the
+// string up front so a large reference is never copied while it grows.
+inline std::string read_sequence(std::string const& path) {
+  SeqReader reader(path);
+  std::string out;
+  out.reserve(reader.size_hint());
+  SeqRecord rec;
+  while (reader.next(rec)) out.append(rec.seq.data(), rec.seq.size());
+  return out;
+}
@@ -0,0 +1,225 @@
+// shards.hpp : a reference split into shards of whole contigs, each with
+// its own Blast_DB, plus a delta segment of sequences appended since.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "blast.hpp"
+#include "contigs.hpp"
+
+// How a shard set is built from FASTA; see Blast_DB and read_shards.
+struct ShardOptions {
+  std::size_t shard_bases = 0;  // 0 keeps the whole reference in one shard
+  bool canonical = false;
+  int window = 1;
+  bool spaced = false;
+  unsigned threads = 1;
+};
+
+// Shards are queried independently and their hits merged per read (see
+// merge_shards), so a reference can be split across index files that are
+// never all resident at once. Sequences appended to a built reference are
+// indexed on their own into a delta segment, queried as one more shard,
+// until compact() folds it into the last shard.
+template <int K>
+class ShardSet {
+ public:
+  typedef Blast_DB<K> db_type;
+
+  // Reads and indexes every shard of a FASTA reference in memory.
+  static ShardSet build(std::string const& path, ShardOptions const& opt) {
+    ShardSet set;
+    read_shards(path, opt.shard_bases, [&](std::string genome, ContigTable contigs) {
+      set.shards_.push_back(index_shard(std::move(genome), std::move(contigs), opt));
+    });
+    return set;
+  }
+
+  // Indexes a FASTA reference shard by shard, writing each to
+  // shard_path(out, n) before reading the next, so only one shard is in
+  // memory at a time. Calls f(db) on each before it is dropped.
+  template <class F>
+  static std::size_t write(std::string const& path, std::string const& out, ShardOptions const& opt,
+                           F&& f) {
+    std::size_t n = 0;
+    read_shards(path, opt.shard_bases, [&](std::string genome, ContigTable contigs) {
+      db_type db = index_shard(std::move(genome), std::move(contigs), opt);
+      db.save(shard_path(out, n), n, 0);
+      f(db);
+      n++;
+    });
+    for (std::size_t s = 0; s < n; s++) {
+      Blast_Base::set_index_shards(shard_path(out, s), static_cast<std::uint32_t>(n));
+    }
+    return n;
+  }
+
+  // Maps every shard of an index written by write() or Blast_DB::save,
+  // and its delta segment if there is one. A delta whose bases the last
+  // shard already holds was left by an interrupted compact_file and is
+  // skipped.
+  static ShardSet open(std::string const& path) {
+    ShardSet set;
+    set.shards_.push_back(db_type::open(path));
+    for (unsigned s = 1; s < set.shards_[0].shards(); s++) {
+      set.shards_.push_back(db_type::open(shard_path(path, s)));
+      if (set.shards_.back().shard() != s) {
+        throw std::runtime_error(shard_path(path, s) + " is not shard " + std::to_string(s) +
+                                 " of " + path);
+      }
+    }
+    std::string delta_file = delta_path(path);
+    if (Blast_Base::is_index_file(delta_file)) {
+      db_type delta = db_type::open(delta_file);
+      std::size_t base = set.bases();
+      if (!delta.delta() || (delta.delta_base() != base && delta.delta_base() + delta.size() != base)) {
+        throw std::runtime_error(delta_file + " is not a delta segment of " + path);
+      }
+      if (delta.delta_base() == base) set.shards_.push_back(std::move(delta));
+    }
+    return set;
+  }
+
+  // Shard 0 is path itself, so an unsharded index is one plain file.
+  static std::string shard_path(std::string const& path, std::size_t n) {
+    return n == 0 ? path : path + "." + std::to_string(n);
+  }
+  static std::string delta_path(std::string const& path) { return path + ".delta"; }
+
+  // Indexes genome, the sequences of contigs, on its own and adds it to
+  // the delta segment, making one if there is none. Only the new bases
+  // are read; an existing delta is merged with them table to table
+  // (Blast_DB::concat). Takes strands and window from the shards.
+  // Contig names must stay unique for SAM and PAF to tell contigs apart:
+  // an unnamed contig whose DEFAULT_CONTIG_NAME is taken gets the first
+  // free "<name>_<n>", n from 2, and any other taken name is an error.
+  void append(std::string genome, ContigTable contigs, unsigned threads = 1) {
+    db_type const& first = shards_[0];
+    if (first.spaced()) {
+      throw std::runtime_error("Spaced seed indexes cannot be appended to");
+    }
+    std::unordered_set<std::string> taken;
+    for (const ContigTable* table : contig_tables()) {
+      for (std::size_t c = 0; c < table->size(); c++) taken.insert(table->name(c));
+    }
+    for (std::size_t c = 0; c < contigs.size(); c++) {
+      if (taken.count(contigs.name(c))) {
+        if (contigs.name(c) != DEFAULT_CONTIG_NAME) {
+          throw std::runtime_error("Contig " + contigs.name(c) + " is already in the index");
+        }
+        for (unsigned n = 2; taken.count(contigs.name(c)); n++) {
+          contigs.rename(c, DEFAULT_CONTIG_NAME + ("_" + std::to_string(n)));
+        }
+      }
+      taken.insert(contigs.name(c));
+    }
+    db_type db(std::move(genome), std::move(contigs), first.canonical(), first.index().window());
+    db.store_polymers(threads);
+    if (has_delta()) {
+      shards_.back() = db_type::concat(shards_.back(), db);
+    } else {
+      db.set_delta(bases());
+      shards_.push_back(std::move(db));
+    }
+  }
+
+  // One named contig.
+  void append(std::string const& name, std::string sequence, unsigned threads = 1) {
+    ContigTable contigs;
+    contigs.add(name, 0);
+    contigs.finish(sequence.size());
+    append(std::move(sequence), std::move(contigs), threads);
+  }
+
+  // Folds the delta segment into the last shard, which then answers for
+  // its contigs.
+  void compact() {
+    if (!has_delta()) return;
+    db_type delta = std::move(shards_.back());
+    shards_.pop_back();
+    shards_.back() = db_type::concat(shards_.back(), delta);
+  }
+
+  // append() for the records of a sequence file, rewriting only the delta
+  // segment of the index at path. Returns the delta's length.
+  static std::size_t append_file(std::string const& path, std::string const& file, unsigned threads = 1) {
+    ShardSet set = open(path);
+    read_shards(file, 0, [&](std::string genome, ContigTable contigs) {
+      if (!genome.empty()) set.append(std::move(genome), std::move(contigs), threads);
+    });
+    if (!set.has_delta()) return 0;
+    replace(set.shards_.back(), delta_path(path), 0, 1);
+    return set.shards_.back().size();
+  }
+
+  // compact() for the index at path. The grown last shard is written
+  // beside the old one and renamed over it, so runs that mapped the old
+  // files keep them, then the delta is removed. Returns false when there
+  // was no delta to fold in; one open() skipped is removed all the same.
+  static bool compact_file(std::string const& path) {
+    ShardSet set = open(path);
+    if (!set.has_delta()) {
+      if (Blast_Base::is_index_file(delta_path(path))) std::remove(delta_path(path).c_str());
+      return false;
+    }
+    set.compact();
+    std::size_t last = set.size() - 1;
+    replace(set.shards_[last], shard_path(path, last), last, set.shards_[last].shards());
+    if (std::remove(delta_path(path).c_str()) != 0) {
+      throw std::runtime_error("Could not remove " + delta_path(path));
+    }
+    return true;
+  }
+
+  bool has_delta() const { return !shards_.empty() && shards_.back().delta(); }
+
+  // Shards, and the delta segment after them.
+  std::size_t size() const { return shards_.size(); }
+  db_type const& operator[](std::size_t s) const { return shards_[s]; }
+
+  std::vector<const ContigTable*> contig_tables() const {
+    std::vector<const ContigTable*> tables;
+    for (db_type const& db : shards_) tables.push_back(&db.contigs());
+    return tables;
+  }
+
+  // Bases and indexed positions over all shards and the delta.
+  std::size_t bases() const {
+    std::size_t n = 0;
+    for (db_type const& db : shards_) n += db.size();
+    return n;
+  }
+  std::size_t seeds() const {
+    std::size_t n = 0;
+    for (db_type const& db : shards_) n += db.index().size();
+    return n;
+  }
+
+ private:
+  // Saves db to path by way of a temporary file, so path is never seen
+  // half written.
+  static void replace(db_type const& db, std::string const& path, unsigned shard, unsigned shards) {
+    std::string tmp = path + ".tmp";
+    db.save(tmp, shard, shards);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+      throw std::runtime_error("Could not replace " + path);
+    }
+  }
+
+  static db_type index_shard(std::string genome, ContigTable contigs, ShardOptions const& opt) {
+    db_type db(std::move(genome), std::move(contigs), opt.canonical, opt.window);
+    if (opt.spaced) db.store_spaced_seeds();
+    else db.store_polymers(opt.threads);
+    return db;
+  }
+
+  std::vector<db_type> shards_;
+};
@@ -0,0 +1,188 @@
+// spaced_seed.hpp : spaced seed patterns fixed at compile time, and an
+// index holding several of them built in one pass.
+//
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "kmer.hpp"
+#include "seed_index.hpp"
+
+// A seed pattern written as a binary literal, first position in the high
+// bit: 0b111010010100110111 is the pattern 111010010100110111. A 1 must
+// match, a 0 is don't-care. Patterns start and end with a 1 and span at
+// most 32 bases.
+template <std::uint64_t Pattern>
+struct SpacedSeed {
+  static_assert(Pattern & 1, "a seed pattern must end with a 1");
+  static constexpr int span = 64 - __builtin_clzll(Pattern);
+  static constexpr int weight = __builtin_popcountll(Pattern);
+  static_assert(span <= 32, "a seed pattern may span at most 32 bases");
+
+  // One maximal run of 1s: (w >> shift) & mask lands in the key at bit out.
+  struct Run {
+    int shift;
+    kmer_t mask;
+    int out;
+  };
+
+  static constexpr int count_runs() {
+    int runs = 0;
+    for (int b = 0; b < span; b++) {
+      if (((Pattern >> b) & 1) && (b == 0 || !((Pattern >> (b - 1)) & 1))) runs++;
+    }
+    return runs;
+  }
+  static constexpr int runs = count_runs();
+
+  static constexpr std::array<Run, runs> make_runs() {
+    std::array<Run, runs> table{};
+    int r = 0, out = 0;
+    for (int b = 0; b < span; ) {
+      if (!((Pattern >> b) & 1)) {
+        b++;
+        continue;
+      }
+      int lo = b;
+      while (b < span && ((Pattern >> b) & 1)) b++;
+      table[r].shift = 2 * lo;
+      table[r].mask = kmer_mask(b - lo);
+      table[r].out = out;
+      out += 2 * (b - lo);
+      r++;
+    }
+    return table;
+  }
+  static constexpr std::array<Run, runs> table = make_runs();
+
+  // Pattern with every bit doubled, to select whole 2-bit bases.
+  static constexpr kmer_t expanded() {
+    kmer_t m = 0;
+    for (int b = 0; b < span; b++) {
+      if ((Pattern >> b) & 1) m |= kmer_t(3) << (2 * b);
+    }
+    return m;
+  }
+
+  // Packs the must-match bases of a span-base window (the low 2 * span
+  // bits of w, packed like KmerEncoder) into a weight-base key, keeping
+  // their order. One pext with BMI2; otherwise a fixed shift-and-mask per
+  // run of 1s, with no loop or branch left after inlining.
+  static kmer_t key(kmer_t w) {
+#ifdef __BMI2__
+    return _pext_u64(w, expanded());
+#else
+    return gather(w, std::make_index_sequence<runs>());
+#endif
+  }
+
+ private:
+  template <std::size_t... R>
+  static kmer_t gather(kmer_t w, std::index_sequence<R...>) {
+    return (kmer_t(0) | ... | (((w >> table[R].shift) & table[R].mask) << table[R].out));
+  }
+};
+
+// One CSR table per pattern (SeedIndex with the patterns' common weight
+// as its word size), all filled by the same two passes over the genome: a
+// single rolling window of the longest span feeds every pattern's key.
+template <std::uint64_t... Patterns>
+class SpacedSeedIndex {
+ public:
+  static constexpr int count = sizeof...(Patterns);
+  static constexpr int max_span = std::max({ SpacedSeed<Patterns>::span... });
+  static constexpr int weight = std::min({ SpacedSeed<Patterns>::weight... });
+  static_assert(((SpacedSeed<Patterns>::weight == weight) && ...),
+                "the patterns of one index must share a weight");
+  static_assert(weight <= SEED_DIRECT_BASES, "spaced seed keys index the table directly");
+
+  typedef SeedIndex<weight> table_type;
+  typedef typename table_type::position_type position_type;
+
+  // No seed spans a position in breaks (ascending), as in SeedIndex.
+  void build(std::string const& genome, std::vector<std::size_t> const& breaks = std::vector<std::size_t>()) {
+    if (genome.size() > UINT32_MAX) {
+      throw std::length_error("Genome too large for 32-bit seed positions");
+    }
+    std::array<std::vector<position_type>, count> offsets;
+    for (int p = 0; p < count; p++) offsets[p].assign(tables_[p].slots() + 1, 0);
+    for_each_seed(genome, [&](int p, std::size_t, kmer_t key) { ++offsets[p][key + 1]; }, breaks);
+
+    std::array<std::vector<position_type>, count> positions;
+    for (int p = 0; p < count; p++) {
+      for (std::size_t w = 1; w < offsets[p].size(); w++) offsets[p][w] += offsets[p][w - 1];
+      positions[p].assign(offsets[p].back(), 0);
+    }
+    // Same cursor trick as SeedIndex::build.
+    for_each_seed(genome, [&](int p, std::size_t start, kmer_t key) {
+      positions[p][offsets[p][key]++] = static_cast<position_type>(start);
+    }, breaks);
+    for (int p = 0; p < count; p++) {
+      std::vector<position_type>& o = offsets[p];
+      for (std::size_t w = o.size() - 1; w > 0; w--) o[w] = o[w - 1];
+      o[0] = 0;
+      tables_[p].assign(std::move(o), std::move(positions[p]));
+    }
+  }
+
+  // Calls f(pattern, start, key) for every window of every pattern in s
+  // whose span holds only ACGT, in order of the window's last base.
+  template <class F>
+  void for_each_seed(std::string const& s, F&& f,
+                     std::vector<std::size_t> const& breaks = std::vector<std::size_t>()) const {
+    KmerEncoder window(max_span);
+    auto next_break = breaks.begin();
+    for (std::size_t i = 0; i < s.size(); i++) {
+      if (next_break != breaks.end() && *next_break == i) {
+        window.reset();
+        ++next_break;
+      }
+      window.push(s[i]);
+      visit(window, i, f, std::make_index_sequence<count>());
+    }
+  }
+
+  position_span lookup(int pattern, kmer_t key) const {
+    return tables_[pattern].lookup(static_cast<typename table_type::key_type>(key));
+  }
+  bool may_contain(int pattern, kmer_t key) const {
+    return tables_[pattern].may_contain(static_cast<typename table_type::key_type>(key));
+  }
+  position_span probe(int pattern, kmer_t key) const {
+    return tables_[pattern].probe(static_cast<typename table_type::key_type>(key));
+  }
+
+  std::size_t memory_bytes() const {
+    std::size_t bytes = 0;
+    for (table_type const& t : tables_) bytes += t.memory_bytes();
+    return bytes;
+  }
+
+ private:
+  template <std::size_t P>
+  static constexpr std::uint64_t pattern() {
+    constexpr std::uint64_t all[] = { Patterns... };
+    return all[P];
+  }
+
+  template <class F, std::size_t... P>
+  static void visit(KmerEncoder const& window, std::size_t i, F& f, std::index_sequence<P...>) {
+    ((window.length() >= SpacedSeed<pattern<P>()>::span
+          ? f(int(P), i + 1 - SpacedSeed<pattern<P>()>::span,
+              SpacedSeed<pattern<P>()>::key(window.value()))
+          : void()), ...);
+  }
+
+  std::array<table_type, count> tables_;
+};
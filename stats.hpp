@@ -0,0 +1,254 @@
+// stats.hpp : per-stage timers, counters and hardware counters for q3.
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hits per read are bucketed by powers of two: 0, 1, 2-3, 4-7, ... and
+// everything from 2^(HIT_BUCKETS - 2) up in the last bucket.
+static const int HIT_BUCKETS = 12;
+
+// How full one bounded queue of the q3 pipeline ran, sampled at every
+// push, and how long its producers waited on it full and its consumers
+// waited on it empty. A stage whose input queue stays full while its
+// output queue stays empty is the one holding the pipeline back.
+struct QueueStats {
+  std::uint64_t capacity = 0;
+  std::uint64_t consumers = 0;  // threads of the stage reading it
+  std::uint64_t pushes = 0;
+  std::uint64_t depth_sum = 0;
+  std::uint64_t max_depth = 0;
+  std::uint64_t full_ns = 0;
+  std::uint64_t empty_ns = 0;
+
+  double mean_depth() const { return pushes ? double(depth_sum) / pushes : 0.0; }
+
+  void merge(QueueStats const& o) {
+    capacity = std::max(capacity, o.capacity);
+    consumers = std::max(consumers, o.consumers);
+    pushes += o.pushes;
+    depth_sum += o.depth_sum;
+    max_depth = std::max(max_depth, o.max_depth);
+    full_ns += o.full_ns;
+    empty_ns += o.empty_ns;
+  }
+};
+
+// Everything is counted per batch by the thread running it and merged in
+// input order, so no counter is ever shared between threads. Code that
+// fills stats takes a QueryStats*; NULL turns every timer and counter off.
+struct QueryStats {
+  enum Stage { SEED, ALIGN, FORMAT, READ, WRITE, STAGES };
+  // The input queue of each pipeline stage; the reader's holds the free
+  // batches the writer hands back.
+  enum Queue { READ_QUEUE, SEED_QUEUE, ALIGN_QUEUE, WRITE_QUEUE, QUEUES };
+
+  std::uint64_t stage_ns[STAGES] = {};
+  std::uint64_t reads = 0;
+  std::uint64_t duplicate_reads = 0;  // reads repeating an earlier read of their batch
+  std::uint64_t seeds_looked_up = 0;  // valid k-mers of the reads
+  std::uint64_t prefilter_rejected = 0;  // lookups the presence filter answered alone
+  std::uint64_t seeds_hit = 0;        // lookups that found genome positions
+  std::uint64_t seed_positions = 0;   // genome positions those lookups returned
+  std::uint64_t two_hit_dropped = 0;
+  std::uint64_t ungapped_dropped = 0;
+  std::uint64_t alignments = 0;      // hits reported
+  std::uint64_t aligned = 0;         // pairs the aligner ran on
+  std::uint64_t cache_lookups = 0;   // distinct pairs of a batch looked up in the cache
+  std::uint64_t cache_hits = 0;
+  std::uint64_t perfect_hits = 0;
+  std::uint64_t hits_per_read[HIT_BUCKETS] = {};
+  QueueStats queues[QUEUES];
+
+  static const char* stage_name(int s) {
+    static const char* const names[] = {"seed", "align", "format", "read", "write"};
+    return names[s];
+  }
+
+  static const char* queue_name(int q) {
+    static const char* const names[] = {"read", "seed", "align", "write"};
+    return names[q];
+  }
+
+  void add_read_hits(std::size_t hits) {
+    int b = 0;
+    while (hits && b < HIT_BUCKETS - 1) {
+      hits >>= 1;
+      b++;
+    }
+    hits_per_read[b]++;
+  }
+
+  void merge(QueryStats const& o) {
+    for (int s = 0; s < STAGES; s++) stage_ns[s] += o.stage_ns[s];
+    reads += o.reads;
+    duplicate_reads += o.duplicate_reads;
+    seeds_looked_up += o.seeds_looked_up;
+    prefilter_rejected += o.prefilter_rejected;
+    seeds_hit += o.seeds_hit;
+    seed_positions += o.seed_positions;
+    two_hit_dropped += o.two_hit_dropped;
+    ungapped_dropped += o.ungapped_dropped;
+    alignments += o.alignments;
+    aligned += o.aligned;
+    cache_lookups += o.cache_lookups;
+    cache_hits += o.cache_hits;
+    perfect_hits += o.perfect_hits;
+    for (int b = 0; b < HIT_BUCKETS; b++) hits_per_read[b] += o.hits_per_read[b];
+    for (int q = 0; q < QUEUES; q++) queues[q].merge(o.queues[q]);
+  }
+};
+
+// Adds the time from construction to destruction, or to stop(), to one
+// stage. Does nothing, not even read the clock, when stats is NULL.
+class StageTimer {
+ public:
+  StageTimer(QueryStats* stats, QueryStats::Stage stage) : stats_(stats), stage_(stage) {
+    if (stats_) start_ = std::chrono::steady_clock::now();
+  }
+
+  ~StageTimer() { stop(); }
+
+  // Ends the stage early; later calls and the destructor add nothing.
+  void stop() {
+    if (stats_) {
+      stats_->stage_ns[stage_] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_).count();
+      stats_ = NULL;
+    }
+  }
+
+  StageTimer(StageTimer const&) = delete;
+  StageTimer& operator=(StageTimer const&) = delete;
+
+ private:
+  QueryStats* stats_;
+  QueryStats::Stage stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Cycles, instructions and cache misses of this process through
+// perf_event_open, including threads started after start(). Counters the
+// kernel refuses (no PMU, perf_event_paranoid) are reported unavailable.
+class PerfCounters {
+ public:
+  enum Counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, COUNTERS };
+
+  PerfCounters() {
+    for (int c = 0; c < COUNTERS; c++) fd_[c] = -1;
+  }
+
+  ~PerfCounters() {
+    for (int c = 0; c < COUNTERS; c++) {
+      if (fd_[c] >= 0) ::close(fd_[c]);
+    }
+  }
+
+  PerfCounters(PerfCounters const&) = delete;
+  PerfCounters& operator=(PerfCounters const&) = delete;
+
+  void start() {
+    static const std::uint64_t configs[COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+    for (int c = 0; c < COUNTERS; c++) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof attr);
+      attr.size = sizeof attr;
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[c];
+      attr.disabled = 1;
+      attr.inherit = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd_[c] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+      if (fd_[c] >= 0) ::ioctl(fd_[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  // Reads the totals; threads must have exited for their counts to show.
+  void stop() {
+    for (int c = 0; c < COUNTERS; c++) {
+      if (fd_[c] < 0) continue;
+      ::ioctl(fd_[c], PERF_EVENT_IOC_DISABLE, 0);
+      if (::read(fd_[c], &value_[c], sizeof value_[c]) != sizeof value_[c]) {
+        ::close(fd_[c]);
+        fd_[c] = -1;
+      }
+    }
+  }
+
+  bool available(Counter c) const { return fd_[c] >= 0; }
+  std::uint64_t value(Counter c) const { return value_[c]; }
+
+  static const char* name(int c) {
+    static const char* const names[] = {"cycles", "instructions", "cache_misses"};
+    return names[c];
+  }
+
+ private:
+  int fd_[COUNTERS];
+  std::uint64_t value_[COUNTERS] = {};
+};
+
+inline void write_stats_json(std::ostream& out, QueryStats const& s, double wall_seconds,
+                             PerfCounters const* perf) {
+  out << "{\n  \"wall_seconds\": " << wall_seconds << ",\n  \"stage_seconds\": {";
+  for (int st = 0; st < QueryStats::STAGES; st++) {
+    out << (st ? ", " : "") << '"' << QueryStats::stage_name(st) << "\": " << s.stage_ns[st] * 1e-9;
+  }
+  out << "},\n  \"counters\": {\"reads\": " << s.reads
+      << ", \"duplicate_reads\": " << s.duplicate_reads
+      << ", \"seeds_looked_up\": " << s.seeds_looked_up
+      << ", \"prefilter_rejected\": " << s.prefilter_rejected
+      << ", \"seeds_hit\": " << s.seeds_hit
+      << ", \"seed_positions\": " << s.seed_positions
+      << ", \"two_hit_dropped\": " << s.two_hit_dropped
+      << ", \"ungapped_dropped\": " << s.ungapped_dropped
+      << ", \"alignments\": " << s.alignments
+      << ", \"aligned\": " << s.aligned
+      << ", \"cache_lookups\": " << s.cache_lookups
+      << ", \"cache_hits\": " << s.cache_hits
+      << ", \"perfect_hits\": " << s.perfect_hits << "},\n";
+  out << "  \"prefilter_rejection_rate\": "
+      << (s.seeds_looked_up ? double(s.prefilter_rejected) / s.seeds_looked_up : 0.0) << ",\n";
+  out << "  \"cache_hit_rate\": "
+      << (s.cache_lookups ? double(s.cache_hits) / s.cache_lookups : 0.0) << ",\n";
+  out << "  \"hits_per_read\": [";
+  for (int b = 0; b < HIT_BUCKETS; b++) {
+    std::uint64_t lo = b == 0 ? 0 : std::uint64_t(1) << (b - 1);
+    out << (b ? ", " : "") << "{\"min\": " << lo << ", ";
+    if (b < HIT_BUCKETS - 1) out << "\"max\": " << (b == 0 ? 0 : 2 * lo - 1) << ", ";
+    out << "\"reads\": " << s.hits_per_read[b] << "}";
+  }
+  out << "],\n  \"queues\": {";
+  for (int q = 0; q < QueryStats::QUEUES; q++) {
+    QueueStats const& qs = s.queues[q];
+    out << (q ? ",\n    " : "\n    ") << '"' << QueryStats::queue_name(q) << "\": {\"threads\": "
+        << qs.consumers << ", \"capacity\": " << qs.capacity << ", \"mean_depth\": "
+        << qs.mean_depth() << ", \"max_depth\": " << qs.max_depth << ", \"full_seconds\": "
+        << qs.full_ns * 1e-9 << ", \"empty_seconds\": " << qs.empty_ns * 1e-9 << "}";
+  }
+  out << "},\n  \"hardware\": ";
+  if (!perf) {
+    out << "null\n}\n";
+    return;
+  }
+  out << "{";
+  for (int c = 0; c < PerfCounters::COUNTERS; c++) {
+    out << (c ? ", " : "") << '"' << PerfCounters::name(c) << "\": ";
+    if (perf->available(PerfCounters::Counter(c))) out << perf->value(PerfCounters::Counter(c));
+    else out << "null";
+  }
+  out << "}\n}\n";
+}
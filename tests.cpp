@@ -0,0 +1,242 @@
+#include "align_cache.hpp"
+#include "blast.hpp"
+#include "contigs.hpp"
+#include "extend.hpp"
+#include "output.hpp"
+#include "query.hpp"
+#include "seq_reader.hpp"
+#include "shards.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/*
+Regression tests for main's query path. Each test builds its inputs in
+memory or in a temporary file, so the run needs no data directory; main
+returns non-zero if any CHECK failed.
+*/
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+// A temporary file holding text, removed again on destruction.
+class TempFile {
+public:
+	explicit TempFile(std::string const& text) {
+		char name[] = "/tmp/genome-test-XXXXXX";
+		int fd = mkstemp(name);
+		if (fd < 0) {
+			std::perror("mkstemp");
+			std::exit(1);
+		}
+		close(fd);
+		path_ = name;
+		std::ofstream(path_, std::ios::binary) << text;
+	}
+	~TempFile() { std::remove(path_.c_str()); }
+	std::string const& path() const { return path_; }
+
+private:
+	std::string path_;
+};
+
+static std::string random_bases(std::mt19937_64& rng, std::size_t n) {
+	static const char bases[] = "ACGT";
+	std::string s(n, 'A');
+	for (char& c : s) c = bases[rng() & 3];
+	return s;
+}
+
+// The tab-separated fields of each line of text.
+static std::vector<std::vector<std::string>> split_lines(std::string const& text) {
+	std::vector<std::vector<std::string>> lines;
+	std::istringstream in(text);
+	std::string line;
+	while (std::getline(in, line)) {
+		lines.emplace_back();
+		std::size_t start = 0;
+		for (std::size_t tab; (tab = line.find('\t', start)) != std::string::npos; start = tab + 1) {
+			lines.back().push_back(line.substr(start, tab - start));
+		}
+		lines.back().push_back(line.substr(start));
+	}
+	return lines;
+}
+
+// One contig named chr1 of n random bases, indexed.
+static Blast_DB<DEFAULT_WORD_SIZE> single_contig_db(std::string const& genome) {
+	ContigTable contigs;
+	contigs.add("chr1", 0);
+	contigs.finish(genome.size());
+	Blast_DB<DEFAULT_WORD_SIZE> db(genome, std::move(contigs));
+	db.store_polymers();
+	return db;
+}
+
+// A FASTA header's description, tabs included, stays out of QNAME and
+// PAF column 1, and out of the columns after them.
+static void test_read_name_is_header_id() {
+	std::mt19937_64 rng(1);
+	std::string genome = random_bases(rng, 2000);
+	auto db = single_contig_db(genome);
+	TempFile reads(">R0_12 sample=A run\t7\n" + genome.substr(500, 100) + "\n");
+	SeqReader reader(reads.path());
+	ReadBatch batch;
+	CHECK(reader.next_batch(batch, 10) == 1);
+	CHECK(batch.names[0] == "R0_12");
+
+	auto sam = split_lines(ProcessBatch(db, batch, ExtendParams(), FORMAT_SAM).text);
+	CHECK(sam.size() == 1);
+	for (auto const& fields : sam) {
+		CHECK(fields.size() == 13);
+		CHECK(fields[0] == "R0_12");
+		CHECK(fields[2] == "chr1");
+		CHECK(fields[3] == "501");
+	}
+	auto paf = split_lines(ProcessBatch(db, batch, ExtendParams(), FORMAT_PAF).text);
+	CHECK(paf.size() == 1);
+	for (auto const& fields : paf) {
+		CHECK(fields.size() == 15);
+		CHECK(fields[0] == "R0_12");
+		CHECK(fields[5] == "chr1");
+	}
+}
+
+static std::vector<std::string> paf_fields(std::string const& seq1, std::string const& seq2,
+                                           std::string const& read, bool reverse) {
+	Blast_Base::alignment aln{ 0, seq1, seq2, "" };
+	HitRecord h{ "r", read, "", "chr1", 1000, 100, reverse, aln };
+	std::string out;
+	format_paf(out, h);
+	return split_lines(out)[0];
+}
+
+// PAF intervals and cg cover the aligned bases only: read bases before
+// the first genome base, or genome bases before the first read base, are
+// left out, as are those after the last.
+static void test_paf_intervals_skip_end_gaps() {
+	// Two read bases before the genome starts and one more inside.
+	auto f = paf_fields("--ACGTAC-GT", "GGACGTACAGT", "GGACGTACAGT", false);
+	CHECK(f[1] == "11");
+	CHECK(f[2] == "2");
+	CHECK(f[3] == "11");
+	CHECK(f[7] == "100");
+	CHECK(f[8] == "108");
+	CHECK(f[9] == "8");
+	CHECK(f[10] == "9");
+	CHECK(f[14] == "cg:Z:6M1I2M");
+
+	// Two genome bases before the read starts, one after it ends.
+	f = paf_fields("TTACGTA", "--ACGT-", "ACGT", false);
+	CHECK(f[2] == "0");
+	CHECK(f[3] == "4");
+	CHECK(f[7] == "102");
+	CHECK(f[8] == "106");
+	CHECK(f[14] == "cg:Z:4M");
+
+	// On the reverse strand the interval is on the read as given.
+	f = paf_fields("--ACGTAC", "GGACGTAC", "GGACGTAC", true);
+	CHECK(f[2] == "0");
+	CHECK(f[3] == "6");
+	CHECK(f[4] == "-");
+}
+
+// Ungapped extension of a seed at the start of a contig stops at the
+// contig's ends, even where the read goes on matching the contigs beside it.
+static void test_ungapped_extension_stays_in_contig() {
+	std::mt19937_64 rng(2);
+	std::string chr1 = random_bases(rng, 100), chr2 = random_bases(rng, 40), chr3 = random_bases(rng, 100);
+	ContigTable contigs;
+	contigs.add("chr1", 0);
+	contigs.add("chr2", 100);
+	contigs.add("chr3", 140);
+	contigs.finish(240);
+	Blast_DB<DEFAULT_WORD_SIZE> db(chr1 + chr2 + chr3, std::move(contigs));
+	db.store_polymers();
+	std::string read = chr1.substr(90) + chr2 + chr3.substr(0, 10);
+
+	UngappedHit hit = extend_ungapped(db, read, 10, 100, DEFAULT_WORD_SIZE, 20, 100, 140);
+	CHECK(hit.query_start == 10);
+	CHECK(hit.query_end == 50);
+	CHECK(hit.genome_start == 100);
+	CHECK(hit.score == 40 * MATCH_BONUS);
+
+	// q3 drops windows starting before their contig, but a window may end
+	// at the contig's end: its filter then scores chr2 alone, short of a
+	// threshold the bases of chr3 would have made up.
+	ReadBatch batch;
+	batch.names.push_back("r");
+	batch.seqs.push_back(chr2 + chr3.substr(0, 20));
+	ExtendParams params;
+	params.min_ungapped = 50 * MATCH_BONUS;
+	SeededBatch seeded = SeedBatch(db, batch, params);
+	for (SeedHit const& h : seeded.hits) CHECK(h.contig != 1);
+}
+
+// Two reads under one key, as a hash collision would give, do not share
+// a cached alignment.
+static void test_alignment_cache_checks_read() {
+	AlignmentCache cache(std::size_t(1) << 20);
+	AlignmentKey key{ 12345, 100, 4, 4 << 1 };
+	cache.insert(key, "ACGT", 8, "4M");
+	int score = 0;
+	std::string cigar;
+	CHECK(!cache.find(key, "ACGA", score, cigar));
+	CHECK(cache.find(key, "ACGT", score, cigar));
+	CHECK(score == 8);
+	CHECK(cigar == "4M");
+}
+
+// Unnamed sequences appended to an index get contig names of their own,
+// and a name already taken is refused.
+static void test_append_keeps_contig_names_unique() {
+	std::mt19937_64 rng(3);
+	TempFile genome(random_bases(rng, 1000) + "\n");
+	auto set = ShardSet<DEFAULT_WORD_SIZE>::build(genome.path(), ShardOptions());
+	set.append(random_bases(rng, 500), ContigTable::single(500));
+	set.append(random_bases(rng, 500), ContigTable::single(500));
+	std::set<std::string> names;
+	std::size_t contigs = 0;
+	for (const ContigTable* table : set.contig_tables()) {
+		for (std::size_t c = 0; c < table->size(); c++, contigs++) names.insert(table->name(c));
+	}
+	CHECK(contigs == 3);
+	CHECK(names == std::set<std::string>({ "genome", "genome_2", "genome_3" }));
+
+	set.append("chr2", random_bases(rng, 100));
+	bool refused = false;
+	try {
+		set.append("chr2", random_bases(rng, 100));
+	} catch (std::runtime_error const&) {
+		refused = true;
+	}
+	CHECK(refused);
+}
+
+int main() {
+	test_read_name_is_header_id();
+	test_paf_intervals_skip_end_gaps();
+	test_ungapped_extension_stays_in_contig();
+	test_alignment_cache_checks_read();
+	test_append_keeps_contig_names_unique();
+	if (failures) {
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	std::printf("All tests passed\n");
+	return 0;
+}